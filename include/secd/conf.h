@@ -4,10 +4,86 @@
 #define TAILRECURSION 1
 #define CASESENSITIVE 1
 
-#define TYPE_BITS  8
-#define NREF_BITS  (8 * sizeof(size_t) - TYPE_BITS)
+/* labels-as-values dispatch in run_secd(), GCC only;
+ * TIMING/CTRLDEBUG use the portable loop */
+#define THREADEDCODE  1
 
-#define DONT_FREE_THIS  (1ul << (8 * sizeof(size_t) - TYPE_BITS - 2))
+/* fuse frequent opcode sequences into one opcode in code vectors */
+#define SUPERINSTRUCTIONS 1
+
+/* S and D are growable arrays of cells instead of lists;
+ * APCC copies them into the continuation it captures */
+#define ARRAYSTACK    1
+
+/* small integers and characters are tagged pointers, not heap cells */
+#define IMMEDIATES    1
+
+/* conses, frames and continuations take half a cell:
+ * 32-bit references instead of pointers, see halfcons_t;
+ * it saves memory, but costs time, see docs/SECD.md;
+ * opt-in: build with -DCOMPACTCONS=1, make check tests both */
+#ifndef COMPACTCONS
+# define COMPACTCONS  0
+#endif
+
+/* the cell header is 32 bits, halfcons_t keeps a reference after it */
+#define TYPE_BITS  5
+#define COLOR_BITS 2
+#define NREF_BITS  (32 - TYPE_BITS - 1 - COLOR_BITS)
+
+#define DONT_FREE_THIS  (1u << (NREF_BITS - 1))
+
+/* a cell shared NREF_MAX times keeps this count: dropping it
+ * does not free it anymore, only a garbage collection does;
+ * a cell referred to by more cells than that saturates it */
+#define NREF_MAX  ((1u << NREF_BITS) - 1)
+
+/* secd -M with COMPACTCONS: a halfcons refers to cells within
+ * 2^31 halfcons_t, the heap must fit there */
+#define HEAP_CELLS_MAX  ((size_t)1 << 28)
+
+/* every cell allocation releases that many dropped cells
+ * waiting in secd->deadq, see free_cell() */
+#define DEADQ_BATCH   2
+
+/* automatic garbage collection, see secd_gc_policy():
+ * the heap is checked after GC_THRESHOLD allocations at least,
+ * it is collected when used cells take GC_TARGET percent of it */
+#define GC_THRESHOLD  4096
+#define GC_TARGET     50
+
+/* after a collection, pop_free() sweeps the fixed cells that
+ * many at a time, when there are no free cells */
+#define SWEEP_CHUNK   256
+
+/* pop_free() keeps that many cells for the opcode that runs out of
+ * memory; the next safe point raises an error if a collection can't
+ * give them back, see secd_check_reserve() */
+#define HEAP_RESERVE  1024
+
+/* a collection is marked by several POSIX threads, one per core
+ * up to MARK_THREADS by default (secd -j), when the heap takes
+ * MARK_PARALLEL cells at least, see mark_parallel() */
+#define PARALLELMARK  1
+#define MARK_THREADS  4
+#define MARK_PARALLEL (256 * 1024)
+
+/* compound cells dropped, but still in use, are remembered as
+ * possible roots of garbage cycles; cycles are collected when
+ * there are CYCLE_ROOTS of them, see secd_collect_cycles() */
+#define CYCLE_ROOTS   4096
+
+/* after a cycle collection, the next one waits for CYCLE_LAZY
+ * allocations for every cell in use it has looked at */
+#define CYCLE_LAZY    4
+
+/* free array areas are kept in lists by size class,
+ * the class of an area of n cells is log2(n), see alloc_array() */
+#define ARRAY_BINS    24
+
+/* after a collection the array heap is compacted
+ * if free areas take ARRAY_COMPACT percent of it */
+#define ARRAY_COMPACT 25
 
 #if CASESENSITIVE
 # define str_eq(s1, s2)  !strcmp(s1, s2)
@@ -22,6 +98,9 @@
 #define CTRLDEBUG   0
 #define ENVDEBUG    0
 #define TIMING      0
+/* count executed pairs and triples of opcodes, see (secd 'opstats);
+ * superinstructions are not fused then, sequences are counted as compiled */
+#define OPSTATS     0
 
 #endif //__SECD_CONF_H___
 
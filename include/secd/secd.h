@@ -52,6 +52,7 @@ typedef  struct secd    secd_t;
 typedef  struct cell    cell_t;
 
 typedef  struct cons  cons_t;
+typedef  struct halfcons halfcons_t;
 typedef  struct symbol symbol_t;
 typedef  struct error error_t;
 typedef  struct frame frame_t;
@@ -87,7 +88,8 @@ typedef enum {
     SECD_DUM,
     /* (x . y . s, e, EQ.c, d) -> ((eq? x y) . s, e, c, d) */
     SECD_EQ,
-    /* (s, e, JOIN.nil, c'.d) -> (s, e, c', d) */
+    /* (s, e, JOIN.nil, c'.d) -> (s, e, c', d)
+     *   in a code vector: JOIN n jumps over n cells */
     SECD_JOIN,
     /* (s, e, LD.v.c, d) -> (lookup(v, e).s, e, c, d) */
     SECD_LD,
@@ -95,10 +97,15 @@ typedef enum {
     SECD_LDC,
     /* (s, e, LDF.(args c').c, d) -> (clos(args, c', e).s, e, c, d) */
     SECD_LDF,
+    /* (s, e, LDV.(depth . index).c, d) -> (lookup(depth, index, e).s, e, c, d)
+     *   the value at index in the frame skipping depth frames of e */
+    SECD_LDV,
     /* (x&int . y&int . s, e, LEQ.c, d) -> ((x <= y).s, e, c, d) */
     SECD_LEQ,
     /* (x&int . y&int . s, e, MUL.c, d) -> ((x * y).s, e, c, d) */
     SECD_MUL,
+    /* (v.s, e, POP.c, d) -> (s, e, c, d) */
+    SECD_POP,
     /* (v.s, e, PRINT.c, d) -> (v.s, e, c, d) with priting v to *stdout* */
     SECD_PRN,
     /* (clos(args, c', e').argv.s, e', RAP.c, d)
@@ -111,16 +118,34 @@ typedef enum {
     SECD_REM,
     /* (v.nil, e, RTN.nil, kont(s',e',c').d) -> (v.s', e', c', d) */
     SECD_RTN,
-    /* (v&bool . s, e, SEL.thenc.elsec.c, d) -> (s, e, (v ? thenc : elsec), c.d) */
+    /* (v&bool . s, e, SEL.thenc.elsec.c, d) -> (s, e, (v ? thenc : elsec), c.d)
+     *   in a code vector: SEL n jumps over n cells of thenc if v is false */
     SECD_SEL,
     /* (v.s, e, c, d) -> stop. */
     SECD_STOP,
     /* (x&int . y&int . s, e, SUB.c, d) -> ((x - y).s, e, c, d) */
     SECD_SUB,
+    /* (clos(args, c', e').argv.s, e, TAP.c, d)
+     *   -> (nil, frame(args, argv).e', c', d)
+     *   AP in a tail position: the caller's state is not saved */
+    SECD_TAP,
     /* (v . s, e, TYPE.c, d) -> (type(v).s, e, c, d) */
     SECD_TYPE,
 
     SECD_LAST, // not an operation
+
+    /* superinstructions: never in control paths, the code vector
+     * compiler fuses a sequence of the opcodes into one of these,
+     * the operands follow in the same order */
+    SECD_CDR_CAR,   // CDR CAR
+    SECD_EQ_SEL,    // EQ SEL n
+    SECD_LDC_LDV,   // LDC v LDV (i . j)
+    SECD_LDV_CAR,   // LDV (i . j) CAR
+    SECD_LDV_CDR,   // LDV (i . j) CDR
+    SECD_LDV_LDV,   // LDV (i1 . j1) LDV (i2 . j2)
+    SECD_LEQ_SEL,   // LEQ SEL n
+
+    SECD_OPCOUNT
 } opindex_t;
 
 enum cell_type {
@@ -181,6 +206,12 @@ struct metacons {
     bool cells:1;   // does area contain cells
 };
 
+/* a dropped cell waiting in secd->deadq, see free_cell() */
+struct deadcell {
+    void *keep[2];  // the references to release yet
+    cell_t *next;   // the next cell in the queue
+};
+
 struct port {
     unsigned char type:3;
     bool input:1;
@@ -210,9 +241,19 @@ cell_t *new_error(secd_t *, cell_t *info, const char *fmt, ...);
 cell_t *new_errorv(secd_t *secd, cell_t *info, const char *fmt, va_list va);
 cell_t *new_error_with(secd_t *secd, cell_t *preverr, const char *fmt, ...);
 
+/* colors of cells for the cycle collector, see secd_collect_cycles() */
+enum cycle_color {
+    CYCLE_BLACK = 0,    // in use or not looked at
+    CYCLE_GRAY,         // being looked at
+    CYCLE_WHITE,        // garbage
+    CYCLE_PURPLE,       // a possible root of a garbage cycle
+};
+
 struct cell {
     enum cell_type type:TYPE_BITS;
-    size_t nref:NREF_BITS;
+    uint32_t half:1;        // this is a halfcons_t
+    uint32_t color:COLOR_BITS;
+    uint32_t nref:NREF_BITS;
 
     union {                 // if cell_type is:
         cons_t   cons;          // CELL_CONS, CELL_FREE
@@ -228,9 +269,38 @@ struct cell {
         opindex_t op;           // CELL_OP
         struct metacons mcons;  // CELL_ARRMETA
         struct kont     kont;   // CELL_KONT
+        struct deadcell dead;   // in secd->deadq
     } as;
 };
 
+/* A compact cell: with COMPACTCONS a cell is split into two of them.
+ * The header is the same as in struct cell, the rest are 32-bit
+ * references (see half_ref()):
+ *   0 is NIL, ...01 and ...11 are immediates (30-bit values),
+ *   ...10 is the offset of the cell from this one in halfcons_t sizes,
+ * so a halfcons needs no fixing when the heap is moved; full cells
+ * (arrays and their data, errors, symbols, ports) hold pointers.
+ * CELL_CONS uses car/cdr, CELL_FRAME is car/cdr with io in aux,
+ * CELL_KONT is stack/env/ctrl in car/cdr/aux.
+ * A free halfcons is in the list secd->halffree instead. */
+struct halfcons {
+    enum cell_type type:TYPE_BITS;
+    uint32_t half:1;
+    uint32_t color:COLOR_BITS;
+    uint32_t nref:NREF_BITS;
+    int32_t aux;
+
+    union {
+        struct {
+            int32_t car;
+            int32_t cdr;
+        };
+        halfcons_t *next;   // CELL_FREE
+    };
+};
+
+#define SECD_HALFREF_TAG  2
+
 #define SECD_PORTTYPES_MAX  8
 
 typedef  struct portops  portops_t;
@@ -238,7 +308,9 @@ typedef  struct portops  portops_t;
 typedef enum {
     SECD_NOPOST = 0,
     SECDPOST_GC,
-    SECDPOST_MACHINE_DUMP
+    SECDPOST_CYCLES,
+    SECDPOST_MACHINE_DUMP,
+    SECDPOST_IMAGE
 } secdpostop_t;
 
 typedef struct secd_stat {
@@ -246,7 +318,20 @@ typedef struct secd_stat {
     size_t used_control;
     size_t used_dump;
     size_t free_cells;
+    size_t free_halves;
     size_t n_alloc;
+    size_t n_gc;
+    size_t n_compact;   // array heap compactions
+    size_t unswept;     // halves of cells not marked, waiting to be swept
+    size_t arr_free;    // cells in free array areas
+    size_t arr_nfree;   // number of free array areas
+    size_t arr_allocs;  // array allocations
+    size_t arr_probes;  // free areas looked at by array allocations
+    size_t dead_cells;  // dropped cells waiting in secd->deadq
+    size_t dead_max;    // the longest secd->deadq
+    size_t n_cycles;    // cycle collections
+    size_t cycle_cells; // cells freed by them
+    size_t cycle_grays; // cells looked at by them
 } secd_stat_t;
 
 struct secd {
@@ -261,8 +346,21 @@ struct secd {
     cell_t *control;    // list of CELL_OP
     cell_t *dump;       // list of CELL_KONT
 
+#if (ARRAYSTACK)
+    /* S and D as arrays, secd->stack and secd->dump stay NIL */
+    cell_t *stackarr;   // values of all frames, a frame starts after a marker
+    size_t stackptr;    // the first unused item of stackarr
+    size_t stackbase;   // the first item of the current frame
+    cell_t *dumparr;    // array of CELL_KONT refs
+    size_t dumpptr;     // the first unused item of dumparr
+#endif
+
     cell_t *free;       // double-linked list
+    cell_t *halffree;   // list of free halfcons_t
+    cell_t *deadq;      // dropped cells to be released, see free_cell()
     cell_t *global_env; // frame
+    cell_t *globals;    // hash table of the global frame bindings
+    size_t nglobals;    // number of symbols in the hash table
     cell_t *symstore;   // symbol storage info array
 
     // all cells before this one are fixed-size cells
@@ -274,8 +372,16 @@ struct secd {
     // this one and all cells after are managed memory for arrays
 
     cell_t *arrlist;    // cdr points to the double-linked list of array metaconses
+    cell_t *arrbins[ARRAY_BINS]; // lists of free array areas by size class
 
     cell_t *end;        // the last cell of the heap
+    size_t heapsize;    // cells the heap may use now, grows up to end - begin
+
+    /* a bit for every half of a heap cell, set if it's marked in use
+     * by the last collection, see secd_mark_and_sweep_gc();
+     * takes the cells after secd->end */
+    uint8_t *markbits;
+    cell_t *sweepptr;   // the next fixed cell to sweep, NIL when all are swept
 
     /**** I/O ****/
     cell_t *input_port;
@@ -293,6 +399,20 @@ struct secd {
 
     /* some operation to be done after the current opcode */
     secdpostop_t postop;
+    unsigned rundepth;      // nested run_secd() calls
+    const char *imagepath;  // where (secd 'image) saves the heap, or NULL
+
+    /* automatic garbage collection, see secd_gc_policy() */
+    size_t gc_threshold;    // allocations between heap checks, 0 disables
+    unsigned gc_target;     // percent of the heap used before collecting
+    size_t gc_next;         // stat.n_alloc to check the heap at
+    bool outofmem;          // pop_free() has taken HEAP_RESERVE
+    unsigned markthreads;   // threads marking the heap, see PARALLELMARK
+
+    /* possible roots of garbage cycles, see secd_collect_cycles() */
+    cell_t *cycroots[CYCLE_ROOTS];
+    size_t ncycroots;
+    size_t cycle_next;      // stat.n_alloc to collect cycles after
 
     /* some statistics */
     secd_stat_t stat;
@@ -304,8 +424,41 @@ struct secd {
  */
 extern int secd_errorf(secd_t *, const char *, ...);
 
+/*
+ *  Immediate values: a cell_t pointer with the lowest bit set is not
+ *  a heap cell, it holds a small integer (tag 01) or a character (tag 11)
+ *  shifted left by 2 bits; these are never shared, dropped or collected.
+ */
+#define SECD_TAG_MASK   3
+#define SECD_FIXNUM_TAG 1
+#define SECD_CHAR_TAG   3
+
+inline static bool is_immediate(const cell_t *c) {
+#if (IMMEDIATES)
+    return (uintptr_t)c & 1;
+#else
+    (void)c;
+    return false;
+#endif
+}
+
+inline static bool fits_immediate(int n) {
+    return ((INTPTR_MIN / 4) <= n) && (n <= (INTPTR_MAX / 4));
+}
+
+inline static cell_t *new_immediate(int n, uintptr_t tag) {
+    return (cell_t *)(((intptr_t)n * 4) | tag);
+}
+
+inline static int immval(const cell_t *c) {
+    return (int)((intptr_t)c >> 2);
+}
+
 inline static enum cell_type cell_type(const cell_t *c) {
     if (!c) return CELL_CONS;
+    if (is_immediate(c))
+        return (((uintptr_t)c & SECD_TAG_MASK) == SECD_CHAR_TAG ?
+                CELL_CHAR : CELL_INT);
     return c->type;
 }
 
@@ -318,8 +471,9 @@ inline static bool not_nil(const cell_t *cell) {
 }
 
 inline static long cell_index(secd_t *secd, const cell_t *cons) {
-    if (is_nil(cons)) return -1;
-    return cons - secd->begin;
+    if (is_nil(cons) || is_immediate(cons)) return -1;
+    /* a halfcons has the index of the cell it is a half of */
+    return ((const char *)cons - (const char *)secd->begin) / sizeof(cell_t);
 }
 
 inline static const char * symname(const cell_t *c) {
@@ -336,6 +490,7 @@ inline static hash_t symhash(const cell_t *c) {
 }
 
 inline static int numval(const cell_t *c) {
+    if (is_immediate(c)) return immval(c);
     return c->as.num;
 }
 inline static const char *strval(const cell_t *c) {
@@ -359,24 +514,71 @@ inline static const char * errmsg(const cell_t *err) {
 
 void dbg_print_cell(secd_t *secd, const cell_t *c);
 
+/* decodes a reference of a halfcons */
+inline static cell_t *half_ref(const halfcons_t *h, int32_t ref) {
+    if ((ref & SECD_TAG_MASK) == SECD_HALFREF_TAG)
+        return (cell_t *)(h + (ref >> 2));
+    return (cell_t *)(intptr_t)ref;     /* NIL or an immediate */
+}
+
+inline static cell_t *get_car(const cell_t *cons) {
+#if (COMPACTCONS)
+    if (cons->half)
+        return half_ref((const halfcons_t *)cons, ((const halfcons_t *)cons)->car);
+#endif
+    return cons->as.cons.car;
+}
+inline static cell_t *get_cdr(const cell_t *cons) {
+#if (COMPACTCONS)
+    if (cons->half)
+        return half_ref((const halfcons_t *)cons, ((const halfcons_t *)cons)->cdr);
+#endif
+    return cons->as.cons.cdr;
+}
+
+/* the cons of *stdin* and *stdout* of a frame */
+inline static cell_t *frame_io(const cell_t *frame) {
+#if (COMPACTCONS)
+    if (frame->half)
+        return half_ref((const halfcons_t *)frame, ((const halfcons_t *)frame)->aux);
+#endif
+    return frame->as.frame.io;
+}
+
+/* the state saved in a continuation */
+inline static cell_t *saved_stack(const cell_t *kont) {
+#if (COMPACTCONS)
+    if (kont->half)
+        return half_ref((const halfcons_t *)kont, ((const halfcons_t *)kont)->car);
+#endif
+    return kont->as.kont.stack;
+}
+inline static cell_t *saved_env(const cell_t *kont) {
+#if (COMPACTCONS)
+    if (kont->half)
+        return half_ref((const halfcons_t *)kont, ((const halfcons_t *)kont)->cdr);
+#endif
+    return kont->as.kont.env;
+}
+inline static cell_t *saved_ctrl(const cell_t *kont) {
+#if (COMPACTCONS)
+    if (kont->half)
+        return half_ref((const halfcons_t *)kont, ((const halfcons_t *)kont)->aux);
+#endif
+    return kont->as.kont.ctrl;
+}
+
 inline static cell_t *list_next(secd_t *secd, const cell_t *cons) {
     if (cell_type(cons) != CELL_CONS) {
         errorf("list_next: not a cons at [%ld]\n", cell_index(secd, cons));
         dbg_print_cell(secd, cons);
         return NULL;
     }
-    return cons->as.cons.cdr;
+    return get_cdr(cons);
 }
 
 inline static cell_t *list_head(const cell_t *cons) {
-    return cons->as.cons.car;
-}
-
-inline static cell_t *get_car(const cell_t *cons) {
-    return cons->as.cons.car;
-}
-inline static cell_t *get_cdr(const cell_t *cons) {
-    return cons->as.cons.cdr;
+    return get_car(cons);
 }
 inline static bool is_cons(const cell_t *cell) {
     if (is_nil(cell)) return true;
@@ -386,7 +588,7 @@ inline static bool is_symbol(const cell_t *cell) {
     return cell_type(cell) == CELL_SYM;
 }
 inline static bool is_number(const cell_t *cell) {
-    return cell->type == CELL_INT;
+    return cell_type(cell) == CELL_INT;
 }
 
 inline static bool is_error(const cell_t *cell) {
@@ -429,6 +631,18 @@ void sexp_display(secd_t *secd, cell_t *port, cell_t *cell);
 cell_t *sexp_parse(secd_t *secd, cell_t *port);
 cell_t *sexp_lexeme(secd_t *secd, int line, int pos, int prevchar);
 
+/* compiled code, see secdb.c;
+ * secdb_load() returns SECD_NIL if the file is not compiled code */
+int secdb_write(secd_t *secd, cell_t *code, const char *path);
+cell_t *secdb_load(secd_t *secd, const char *path);
+
+typedef struct secdb_writer  secdb_writer_t;
+
+secdb_writer_t *secdb_list_new(void);
+int secdb_list_add(secd_t *secd, secdb_writer_t *w, cell_t *code);
+int secdb_list_write(secd_t *secd, secdb_writer_t *w, const char *path);
+void secdb_list_free(secdb_writer_t *w);
+
 cell_t *read_secd(secd_t *secd);
 
 /*
@@ -436,7 +650,17 @@ cell_t *read_secd(secd_t *secd);
  */
 
 secd_t * init_secd(secd_t *secd, cell_t *heap, size_t ncells);
+void secd_set_heapsize(secd_t *secd, size_t ncells);
 cell_t * run_secd(secd_t *secd, cell_t *ctrl);
+cell_t * secd_resume(secd_t *secd);
+cell_t * secd_run_source(secd_t *secd, cell_t *compiler, const char *path,
+                         const char *cachepath);
+cell_t * secd_run_compiled(secd_t *secd, cell_t *forms);
+void secd_print_opstats(secd_t *secd);
+
+/* heap images, see image.c */
+int secd_save_image(secd_t *secd, const char *path);
+secd_t * secd_load_image(secd_t *secd, const char *path);
 
 /* serialization */
 cell_t *serialize_cell(secd_t *secd, cell_t *cell);
@@ -445,6 +669,7 @@ cell_t *secd_mem_info(secd_t *secd);
 /* control path */
 bool is_control_compiled(cell_t *control);
 cell_t *compile_control_path(secd_t *secd, cell_t *control);
+cell_t *compile_code_vector(secd_t *secd, cell_t *control);
 
 cell_t *secd_execute(secd_t *secd, cell_t *clos, cell_t *argv);
 cell_t *secd_raise(secd_t *secd, cell_t *exc);
@@ -23,6 +23,10 @@ typedef size_t (*portread_func_t)(secd_t *, cell_t *, size_t, char *);
 typedef int (*portclose_func_t)(secd_t *, cell_t *);
 typedef cell_t *(*portowns_func_t)(secd_t*, cell_t *,cell_t **, cell_t **, cell_t **);
 typedef cell_t *(*portstd_func_t)(secd_t*, enum secd_portstd);
+/* a heap image keeps a copy of a port made by pimage(), prestore() makes
+ * it work again in the loaded heap, moved by delta bytes */
+typedef void (*portimage_func_t)(secd_t *, const cell_t *, cell_t *);
+typedef void (*portrestore_func_t)(secd_t *, cell_t *, ptrdiff_t delta);
 
 struct portops {
     portinfo_func_t pinfo;
@@ -34,6 +38,8 @@ struct portops {
     portclose_func_t pclose;
     portowns_func_t powns;
     portstd_func_t pstd;
+    portimage_func_t pimage;
+    portrestore_func_t prestore;
 };
 
 
@@ -62,6 +68,8 @@ cell_t *secd_pserialize(secd_t *secd, cell_t *p);
 cell_t *secd_newport(secd_t *secd, const char *mode, const char *ty, cell_t *params);
 cell_t *secd_newport_by_name(secd_t *secd, const char *mode, const char *ty, const char * name);
 cell_t *secd_port_owns(secd_t *secd, cell_t *p, cell_t **, cell_t **, cell_t **);
+void secd_pimage(secd_t *secd, const cell_t *port, cell_t *img);
+void secd_prestore(secd_t *secd, cell_t *port, ptrdiff_t delta);
 
 const char * secd_porttyname(secd_t *secd, int ty);
 int secd_pdump_array(secd_t *secd, cell_t *p, cell_t *mcons);
@@ -70,6 +78,7 @@ static inline bool is_closed(cell_t *port) {
     return !port->as.port.input && !port->as.port.output;
 }
 
+void secd_init_porttypes(secd_t *secd);
 void secd_init_ports(secd_t *secd);
 
 #include "conf.h"
@@ -79,99 +79,157 @@
 ;;  Scheme to SECD compiler
 ;;
 
+;; env is the list of argument lists of the enclosing lambdas,
+;; the innermost first: a variable bound there is loaded with
+;; LDV (depth . index), other variables are looked up by name.
+(frame-index (lambda (sym args index)
+  (cond
+    ((null? args) '())
+    ((symbol? args) (if (eq? sym args) index '()))   ;; a rest argument
+    ((eq? sym (car args)) index)
+    (else (frame-index sym (cdr args) (+ 1 index))))))
+
+(lookup-lexical (lambda (sym env depth)
+  (if (null? env) '()
+      (let ((index (frame-index sym (car env) 0)))
+        (if (null? index)
+            (lookup-lexical sym (cdr env) (+ 1 depth))
+            (cons depth index))))))
+
+(compile-variable (lambda (sym env)
+  (let ((addr (lookup-lexical sym env 0)))
+    (cond
+      ((null? addr) (list 'LD sym))
+      ;; the current ports are looked up by name
+      ((memq sym '(*stdin* *stdout* *stddbg*)) (list 'LD sym))
+      (else (list 'LDV addr))))))
+
 (compile-bindings
-  (lambda (bs)
+  (lambda (bs env)
     (if (null? bs) '(LDC ())
-        (append (compile-bindings (cdr bs))
-                (secd-compile (car bs))
+        (append (compile-bindings (cdr bs) env)
+                (compile-expr (car bs) env)
                 '(CONS)))))
 
 (compile-n-bindings
-  (lambda (bs)
+  (lambda (bs env)
     (if (null? bs) '()
-        (append (compile-n-bindings (cdr bs))
-                (secd-compile (car bs))))))
+        (append (compile-n-bindings (cdr bs) env)
+                (compile-expr (car bs) env)))))
+
+(compile-begin-seq
+  (lambda (stmts env)
+    (if (null? (cdr stmts))
+        (compile-expr (car stmts) env)
+        (append (compile-expr (car stmts) env) '(POP)
+                (compile-begin-seq (cdr stmts) env)))))
+
+;; a function body: AP at the end of the body or of its SEL branches
+;; becomes TAP, the callee returns straight to our caller.
+(code-end? (lambda (code)
+  (cond
+    ((null? code) #t)
+    ((eq? (car code) 'JOIN) (null? (cdr code)))
+    (else #f))))
 
-(compile-begin-acc
-  (lambda (stmts acc)   ; acc must be '(LDC ()) at the beginning
-    (if (null? stmts)
-        (append acc '(CAR))
-        (compile-begin-acc (cdr stmts)
-                           (append acc (secd-compile (car stmts)) '(CONS))))))
+(compile-tail (lambda (code)
+  (if (null? code) '()
+    (let ((op (car code))
+          (rest (cdr code)))
+      (cond
+        ((eq? op 'AP)
+          (cond
+            ((code-end? rest) (cons 'TAP rest))
+            ((number? (car rest))
+              (if (code-end? (cdr rest))
+                  (cons 'TAP rest)
+                  (cons op (cons (car rest) (compile-tail (cdr rest))))))
+            (else (cons op (compile-tail rest)))))
+        ((eq? op 'SEL)
+          (if (code-end? (cddr rest))
+              (cons op (cons (compile-tail (car rest))
+                             (cons (compile-tail (cadr rest)) (cddr rest))))
+              (cons op (cons (car rest) (cons (cadr rest) (compile-tail (cddr rest)))))))
+        ((memq op '(LD LDC LDF LDV))
+          (cons op (cons (car rest) (compile-tail (cdr rest)))))
+        (else (cons op (compile-tail rest))))))))
+
+(compile-body (lambda (body env)
+  (append (compile-tail (compile-expr (cons 'begin body) env)) '(RTN))))
 
 (compile-cond
-  (lambda (conds)
+  (lambda (conds env)
     (if (null? conds)
         '(LDC ())
         (let ((clause-cond (car (car conds)))
               (clause-body (cdr (car conds))))
           (let ((compiled-body
                   (if (eq? (car clause-body) '=>)
-                      (secd-compile (cadr clause-body))
-                      (secd-compile (cons 'begin clause-body)))))
+                      (compile-expr (cadr clause-body) env)
+                      (compile-expr (cons 'begin clause-body) env))))
             (if (eq? clause-cond 'else)
                 compiled-body
-                (append (secd-compile clause-cond) '(SEL)
+                (append (compile-expr clause-cond env) '(SEL)
                         (list (append compiled-body '(JOIN)))
-                        (list (append (compile-cond (cdr conds)) '(JOIN))))))))))
+                        (list (append (compile-cond (cdr conds) env) '(JOIN))))))))))
 
 (compile-quasiquote
-  (lambda (lst)
+  (lambda (lst env)
     (cond
       ((null? lst) (list 'LDC '()))
       ((pair? lst)
         (let ((hd (car lst)) (tl (cdr lst)))
            (cond
              ((not (pair? hd))
-                (append (compile-quasiquote tl) (list 'LDC hd 'CONS)))
+                (append (compile-quasiquote tl env) (list 'LDC hd 'CONS)))
              ((eq? (car hd) 'unquote)
-                (append (compile-quasiquote tl) (secd-compile (cadr hd)) '(CONS)))
+                (append (compile-quasiquote tl env) (compile-expr (cadr hd) env) '(CONS)))
                 ;; TODO: (unquote a1 a2 ...)
              ((eq? (car hd) 'unquote-splicing)
                 (display 'Error:_unquote-splicing_TODO)) ;; TODO
-             (else (append (compile-quasiquote tl)
-                           (compile-quasiquote hd) '(CONS))))))
+             (else (append (compile-quasiquote tl env)
+                           (compile-quasiquote hd env) '(CONS))))))
       (else (list 'LDC lst)))))
 
-(compile-form (lambda (f)
+(compile-form (lambda (f env)
   (let ((hd (car f))
         (tl (cdr f)))
     (cond
       ((eq? hd 'quote)
         (list 'LDC (car tl)))
       ((eq? hd 'quasiquote)
-        (compile-quasiquote (car tl)))
+        (compile-quasiquote (car tl) env))
       ((eq? hd '+)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(ADD)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(ADD)))
       ((eq? hd '-)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(SUB)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(SUB)))
       ((eq? hd '*)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(MUL)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(MUL)))
       ((eq? hd '/)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(DIV)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(DIV)))
       ((eq? hd 'remainder)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(REM)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(REM)))
       ((eq? hd '<=)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(LEQ)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(LEQ)))
       ((eq? hd 'secd-type)
-        (append (secd-compile (car tl)) '(TYPE)))
+        (append (compile-expr (car tl) env) '(TYPE)))
       ((eq? hd 'car)
-        (append (secd-compile (car tl)) '(CAR)))
+        (append (compile-expr (car tl) env) '(CAR)))
       ((eq? hd 'cdr)
-        (append (secd-compile (car tl)) '(CDR)))
+        (append (compile-expr (car tl) env) '(CDR)))
       ((eq? hd 'cons)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(CONS)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(CONS)))
       ((eq? hd 'eq? )
-        (append (secd-compile (car tl)) (secd-compile (cadr tl)) '(EQ)))
+        (append (compile-expr (car tl) env) (compile-expr (cadr tl) env) '(EQ)))
       ((eq? hd 'if )
-        (let ((condc (secd-compile (car tl)))
-              (thenb (append (secd-compile (cadr tl)) '(JOIN)))
-              (elseb (append (secd-compile (caddr tl)) '(JOIN))))
+        (let ((condc (compile-expr (car tl) env))
+              (thenb (append (compile-expr (cadr tl) env) '(JOIN)))
+              (elseb (append (compile-expr (caddr tl) env) '(JOIN))))
           (append condc '(SEL) (list thenb) (list elseb))))
       ((eq? hd 'lambda)
-        (let ((args (car tl))
-              (body (append (secd-compile (cons 'begin (cdr tl))) '(RTN))))
-          (list 'LDF (list args body))))
+        (let ((args (car tl)))
+          (let ((body (compile-body (cdr tl) (cons args env))))
+            (list 'LDF (list args body)))))
       ((eq? hd 'let)
         (cond
           ((symbol? (car tl))   ;; let-loop
@@ -186,34 +244,34 @@
                            (cons loopname exprs))))
                   (begin
                     ;(display loopfun)
-                    (secd-compile loopfun))))))
+                    (compile-expr loopfun env))))))
           (else     ;; just let
             (let ((bindings (unzip (car tl)))
                   (body (cdr tl)))
               (let ((args (car bindings))
                     (exprs (cadr bindings)))
-                (append (compile-bindings exprs)
+                (append (compile-bindings exprs env)
                         (list 'LDF
-                            (list args
-                                (append (secd-compile (cons 'begin body)) '(RTN))))
+                            (list args (compile-body body (cons args env))))
                         '(AP)))))))
+      ;; the bindings are evaluated in the new frame too (see DUM/RAP)
       ((eq? hd 'letrec)
         (let ((bindings (unzip (car tl)))
               (body (cdr tl)))
           (let ((args (car bindings))
                 (exprs (cadr bindings)))
+            (let ((recenv (cons args env)))
               (append '(DUM)
-                      (compile-bindings exprs)
+                      (compile-bindings exprs recenv)
                       (list 'LDF
-                        (list args
-                          (append (secd-compile (cons 'begin body)) '(RTN))))
-                      '(RAP)))))
+                        (list args (compile-body body recenv)))
+                      '(RAP))))))
 
-      ;; (begin (e1) (e2) ... (eN)) => LDC () <e1> CONS <e2> CONS ... <eN> CONS CAR
+      ;; (begin (e1) (e2) ... (eN)) => <e1> POP <e2> POP ... <eN>
       ((eq? hd 'begin)
         (cond
-          ((null? tl) '(LDC ()))                        ;; (begin)
-          ((null? (cdr tl)) (secd-compile (car tl)))    ;; (begin (expr)) => (expr)
+          ((null? tl) '(LDC ()))                            ;; (begin)
+          ((null? (cdr tl)) (compile-expr (car tl) env))    ;; (begin (expr)) => (expr)
           ;; TODO: actually, few (define ...) in a row must be rewritten to (letrec* ..)
           ((eq? 'define (caar tl))
             (let ((defform (car tl))
@@ -224,27 +282,27 @@
                   ((symbol? 'what)
                     (let ((letexpr
                             (list 'let (list `(,what ,expr)) (cons 'begin body))))
-                       (secd-compile letexpr)))
+                       (compile-expr letexpr env)))
                   ;;((pair? 'what) ; TODO: check for let/letrec
                   (else 'Error:_define_what?)))))
-          (else (compile-begin-acc tl '(LDC ())))))
+          (else (compile-begin-seq tl env))))
       ((eq? hd 'cond)
-        (compile-cond tl))
+        (compile-cond tl env))
       ((eq? hd 'write)
-        (append (secd-compile (car tl)) '(PRINT)))
+        (append (compile-expr (car tl) env) '(PRINT)))
       ((eq? hd 'read)
         '(READ))
       ((eq? hd 'eval)
-        (append '(LDC () LDC ()) (secd-compile (car tl))
+        (append '(LDC () LDC ()) (compile-expr (car tl) env)
            '(CONS LD secd-from-scheme AP AP)))
         ;(secd-compile `((secd-from-scheme ,(car tl)))))
       ((eq? hd 'secd-apply)
         (cond
           ((null? tl) (display 'Error:_secd-apply_requires_args))
           ((null? (cdr tl)) (display 'Error:_secd-apply_requires_second_arg))
-          (else (append (secd-compile (car (cdr tl))) (secd-compile (car tl)) '(AP)))))
+          (else (append (compile-expr (car (cdr tl)) env) (compile-expr (car tl) env) '(AP)))))
       ((eq? hd 'call/cc)
-        (append (secd-compile (car tl)) '(APCC)))
+        (append (compile-expr (car tl) env) '(APCC)))
       ((eq? hd 'quit)
         '(STOP))
       (else
@@ -252,22 +310,24 @@
           (if (null? macro)
               ;; it is a form
               (let ((compiled-head
-                      (if (symbol? hd) (list 'LD hd) (secd-compile hd)))
+                      (if (symbol? hd) (compile-variable hd env) (compile-expr hd env)))
                     (nbinds (length tl)))
-                (append (compile-n-bindings tl) compiled-head (list 'AP nbinds)))
+                (append (compile-n-bindings tl env) compiled-head (list 'AP nbinds)))
               ;; it is a macro application
               (let ((evalclos (secd-apply macro tl)))
                 (begin
                   ;(display evalclos)   ;; expanded macro
-                  (secd-compile evalclos))))))
+                  (compile-expr evalclos env))))))
     ))))
 
-(secd-compile (lambda (s)
+(compile-expr (lambda (s env)
   (cond
-    ((pair?   s) (compile-form s))
-    ((symbol? s) (list 'LD s))
+    ((pair?   s) (compile-form s env))
+    ((symbol? s) (compile-variable s env))
     (else (list 'LDC s)))))
 
+(secd-compile (lambda (s) (compile-expr s '())))
+
 (secd-compile-top (lambda (s)
     (cond
       ((not (pair? s))
@@ -292,7 +352,7 @@
     (secd-closure (secd-compile-top s) '() '())))
 
 (secd-closure (lambda (ctrlpath args maybe-env)
-  (let ((func (list args (append ctrlpath '(RTN))))
+  (let ((func (list args (append (compile-tail ctrlpath) '(RTN))))
         (env (if (null? maybe-env) (interaction-environment) maybe-env)))
     (cons func env))))
 
@@ -314,7 +374,7 @@
   (let ((macroname (car macrodef))
         (macroargs (cdr macrodef)))
     (let ((macroclos ;; TODO: macrobody may be more longer than 1 form
-            (secd-closure (secd-compile macrobody) macroargs '())))
+            (secd-closure (compile-expr macrobody (list macroargs)) macroargs '())))
       (begin
         ;(display macrobody) ;;; what macro is compiled to.
         (secd-bind! '*macros* (cons (cons macroname macroclos)  *macros*))
@@ -448,6 +508,10 @@
         (lambda (sym val) (list 'vector-set! sym 0 val)))
       (cons 'box-ref
         (lambda (sym) (list 'vector-ref sym 0)))))
+  ;; secd -o repl.img saves the heap here, secd -i repl.img starts here
+  (if (eq? (secd 'image) 'saved)
+    (quit)
+    'else-pass)
   (display ";;;   Welcome to SECDScheme\n")
   (display ";;;     sizeof(cell_t) = ")(display (secd 'cell 'size))(newline)
   (if (defined? 'secd-ffi)
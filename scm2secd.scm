@@ -16,18 +16,45 @@
                  (unzipt rest (append z1 (list p1)) (append z2 (list p2)))))))))
       (unzipt ps '() '()))))
 
+;; env is the list of argument lists of the enclosing lambdas,
+;; the innermost first: a variable bound there is loaded with
+;; LDV (depth . index), other variables are looked up by name.
+(frame-index (lambda (sym args index)
+  (cond
+    ((null? args) '())
+    ((symbol? args) (if (eq? sym args) index '()))   ;; a rest argument
+    ((eq? sym (car args)) index)
+    (else (frame-index sym (cdr args) (+ 1 index))))))
+
+(lookup-lexical (lambda (sym env depth)
+  (if (null? env) '()
+      (let ((index (frame-index sym (car env) 0)))
+        (if (null? index)
+            (lookup-lexical sym (cdr env) (+ 1 depth))
+            (cons depth index))))))
+
+(compile-variable (lambda (sym env)
+  (let ((addr (lookup-lexical sym env 0)))
+    (cond
+      ((null? addr) (list 'LD sym))
+      ;; the current ports are looked up by name
+      ((eq? sym '*stdin*) (list 'LD sym))
+      ((eq? sym '*stdout*) (list 'LD sym))
+      ((eq? sym '*stddbg*) (list 'LD sym))
+      (else (list 'LDV addr))))))
+
 (compile-bindings
-  (lambda (bs)
+  (lambda (bs env)
     (if (null? bs) '(LDC ())
-        (append (compile-bindings (cdr bs))
-                (secd-compile (car bs))
+        (append (compile-bindings (cdr bs) env)
+                (compile-expr (car bs) env)
                 '(CONS)))))
 
 (compile-n-bindings
-  (lambda (bs)
+  (lambda (bs env)
     (if (null? bs) '()
-        (append (compile-n-bindings (cdr bs))
-                (secd-compile (car bs))))))
+        (append (compile-n-bindings (cdr bs) env)
+                (compile-expr (car bs) env)))))
 
 (length (lambda (xs)
   (letrec
@@ -36,134 +63,195 @@
                 (len (cdr xs) (+ 1 acc))))))
     (len xs 0))))
 
-(compile-begin-acc
-  (lambda (stmts acc)   ; acc must be '(LDC ()) at the beginning
-    (if (null? stmts)
-        (append acc '(CAR))
-        (compile-begin-acc (cdr stmts)
-                           (append acc (secd-compile (car stmts)) '(CONS))))))
+(compile-begin
+  (lambda (stmts env)
+    (cond
+      ((null? stmts) '(LDC ()))
+      ((null? (cdr stmts)) (compile-expr (car stmts) env))
+      (else (append (compile-expr (car stmts) env) '(POP)
+                    (compile-begin (cdr stmts) env))))))
+
+;; a function body: AP at the end of the body or of its SEL branches
+;; becomes TAP, the callee returns straight to our caller.
+(code-end? (lambda (code)
+  (cond
+    ((null? code) (eq? 1 1))
+    ((eq? (car code) 'JOIN) (null? (cdr code)))
+    (else (eq? 1 2)))))
+
+(has-operand? (lambda (op)
+  (cond
+    ((eq? op 'LD) (eq? 1 1))
+    ((eq? op 'LDC) (eq? 1 1))
+    ((eq? op 'LDF) (eq? 1 1))
+    ((eq? op 'LDV) (eq? 1 1))
+    (else (eq? 1 2)))))
+
+(compile-tail (lambda (code)
+  (if (null? code) '()
+    (let ((op (car code))
+          (rest (cdr code)))
+      (cond
+        ((eq? op 'AP)
+          (cond
+            ((code-end? rest) (cons 'TAP rest))
+            ((number? (car rest))
+              (if (code-end? (cdr rest))
+                  (cons 'TAP rest)
+                  (cons op (cons (car rest) (compile-tail (cdr rest))))))
+            (else (cons op (compile-tail rest)))))
+        ((eq? op 'SEL)
+          (if (code-end? (cdr (cdr rest)))
+              (cons op (cons (compile-tail (car rest))
+                             (cons (compile-tail (cadr rest)) (cdr (cdr rest)))))
+              (cons op (cons (car rest) (cons (cadr rest) (compile-tail (cdr (cdr rest))))))))
+        ((has-operand? op) (cons op (cons (car rest) (compile-tail (cdr rest)))))
+        (else (cons op (compile-tail rest))))))))
+
+(compile-body (lambda (body env)
+  (append (compile-tail (compile-expr body env)) '(RTN))))
 
 (compile-cond
-  (lambda (conds)
+  (lambda (conds env)
     (if (null? conds)
         '(LDC ())
         (let ((this-cond (car (car conds)))
               (this-expr (cadr (car conds))))
           (if (eq? this-cond 'else)
-              (secd-compile this-expr)
-              (append (secd-compile this-cond) '(SEL)
-                      (list (append (secd-compile this-expr) '(JOIN)))
-                      (list (append (compile-cond (cdr conds)) '(JOIN)))))))))
+              (compile-expr this-expr env)
+              (append (compile-expr this-cond env) '(SEL)
+                      (list (append (compile-expr this-expr env) '(JOIN)))
+                      (list (append (compile-cond (cdr conds) env) '(JOIN)))))))))
 
 (compile-quasiquote
-  (lambda (lst)
+  (lambda (lst env)
     (cond
       ((null? lst) '())
       ((pair? lst)
         (let ((hd (car lst)) (tl (cdr lst)))
           (cond
              ((secd-not (pair? hd))
-                (append (compile-quasiquote tl) (list 'LDC hd 'CONS)))
+                (append (compile-quasiquote tl env) (list 'LDC hd 'CONS)))
              ((eq? (car hd) 'unquote)
-                (append (compile-quasiquote tl) (secd-compile (cadr hd)) '(CONS)))
+                (append (compile-quasiquote tl env) (compile-expr (cadr hd) env) '(CONS)))
                 ;; TODO: (unquote a1 a2 ...)
              ((eq? (car hd) 'unquote-splicing)
                 (display 'Error:_unquote-splicing_TODO)) ;; TODO
-             (else (append (compile-quasiquote tl)
-                           (compile-quasiquote hd) '(CONS))))))
+             (else (append (compile-quasiquote tl env)
+                           (compile-quasiquote hd env) '(CONS))))))
       (else (list 'LDC lst)))))
 
-(compile-form (lambda (f)
+(compile-form (lambda (f env)
   (let ((hd (car f))
         (tl (cdr f)))
     (cond
       ((eq? hd 'quote)
         (list 'LDC (car tl)))
       ((eq? hd 'quasiquote)
-        (append '(LDC ()) (compile-quasiquote (car tl))))
+        (append '(LDC ()) (compile-quasiquote (car tl) env)))
       ((eq? hd '+)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(ADD)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(ADD)))
       ((eq? hd '-)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(SUB)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(SUB)))
       ((eq? hd '*)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(MUL)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(MUL)))
       ((eq? hd '/)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(DIV)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(DIV)))
       ((eq? hd 'remainder)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(REM)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(REM)))
       ((eq? hd '<=)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(LEQ)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(LEQ)))
       ((eq? hd 'eq? )
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(EQ)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(EQ)))
       ((eq? hd 'cons)
-        (append (secd-compile (cadr tl)) (secd-compile (car tl)) '(CONS)))
+        (append (compile-expr (cadr tl) env) (compile-expr (car tl) env) '(CONS)))
       ((eq? hd 'secd-type)
-        (append (secd-compile (car tl)) '(TYPE)))
+        (append (compile-expr (car tl) env) '(TYPE)))
       ((eq? hd 'pair?)
-        (append (secd-compile (car tl)) '(TYPE LDC cons EQ)))
+        (append (compile-expr (car tl) env) '(TYPE LDC cons EQ)))
       ((eq? hd 'car)
-        (append (secd-compile (car tl)) '(CAR)))
+        (append (compile-expr (car tl) env) '(CAR)))
       ((eq? hd 'cdr)
-        (append (secd-compile (car tl)) '(CDR)))
+        (append (compile-expr (car tl) env) '(CDR)))
       ((eq? hd 'cadr)
-        (append (secd-compile (car tl)) '(CDR CAR)))
+        (append (compile-expr (car tl) env) '(CDR CAR)))
       ((eq? hd 'caddr)
-        (append (secd-compile (car tl)) '(CDR CDR CAR)))
+        (append (compile-expr (car tl) env) '(CDR CDR CAR)))
       ((eq? hd 'if )
-        (let ((condc (secd-compile (car tl)))
-              (thenb (append (secd-compile (cadr tl)) '(JOIN)))
-              (elseb (append (secd-compile (caddr tl)) '(JOIN))))
+        (let ((condc (compile-expr (car tl) env))
+              (thenb (append (compile-expr (cadr tl) env) '(JOIN)))
+              (elseb (append (compile-expr (caddr tl) env) '(JOIN))))
           (append condc '(SEL) (list thenb) (list elseb))))
       ((eq? hd 'lambda)
-        (let ((args (car tl))
-              (body (append (secd-compile (cadr tl)) '(RTN))))
-          (list 'LDF (list args body))))
+        (let ((args (car tl)))
+          (let ((body (compile-body (cadr tl) (cons args env))))
+            (list 'LDF (list args body)))))
       ((eq? hd 'let)
         (let ((bindings (unzip (car tl)))
               (body (cadr tl)))
           (let ((args (car bindings))
                 (exprs (cadr bindings)))
-            (append (compile-bindings exprs)
-                    (list 'LDF (list args (append (secd-compile body) '(RTN))))
+            (append (compile-bindings exprs env)
+                    (list 'LDF (list args (compile-body body (cons args env))))
                     '(AP)))))
+      ;; the bindings are evaluated in the new frame too (see DUM/RAP)
       ((eq? hd 'letrec)
         (let ((bindings (unzip (car tl)))
               (body (cadr tl)))
           (let ((args (car bindings))
                 (exprs (cadr bindings)))
+            (let ((recenv (cons args env)))
               (append '(DUM)
-                      (compile-bindings exprs)
-                      (list 'LDF (list args (append (secd-compile body) '(RTN))))
-                      '(RAP)))))
+                      (compile-bindings exprs recenv)
+                      (list 'LDF (list args (compile-body body recenv)))
+                      '(RAP))))))
 
-      ;; (begin (e1) (e2) ... (eN)) => LDC () <e1> CONS <e2> CONS ... <eN> CONS CAR
+      ;; (begin (e1) (e2) ... (eN)) => <e1> POP <e2> POP ... <eN>
       ((eq? hd 'begin)
-        (compile-begin-acc tl '(LDC ())))
+        (compile-begin tl env))
       ((eq? hd 'cond)
-        (compile-cond tl))
+        (compile-cond tl env))
       ((eq? hd 'write)
-        (append (secd-compile (car tl)) '(PRINT)))
+        (append (compile-expr (car tl) env) '(PRINT)))
       ((eq? hd 'read)
         '(READ))
       ((eq? hd 'eval)
-        (append '(LDC () LDC () LDC () CONS) (secd-compile (car tl)) '(CONS LD secd-from-scheme AP AP)))
+        (append '(LDC () LDC () LDC () CONS) (compile-expr (car tl) env) '(CONS LD secd-from-scheme AP AP)))
       ((eq? hd 'secd-apply)
-        (append (secd-compile (car (cdr tl))) (secd-compile (car tl)) '(AP)))
+        (append (compile-expr (car (cdr tl)) env) (compile-expr (car tl) env) '(AP)))
       ((eq? hd 'quit)
         '(STOP))
       (else
-        (let ((compiled-head
-                (if (symbol? hd) (list 'LD hd) (secd-compile hd)))
+        (let ((compiled-head (compile-expr hd env))
               (nbinds (length tl)))
-         (append (compile-n-bindings tl) compiled-head (list 'AP nbinds))))
+         (append (compile-n-bindings tl env) compiled-head (list 'AP nbinds))))
     ))))
 
-(secd-compile (lambda (s)
+(compile-expr (lambda (s env)
   (cond
-    ((pair? s)   (compile-form s))
-    ((symbol? s) (list 'LD s))
+    ((pair? s)   (compile-form s env))
+    ((symbol? s) (compile-variable s env))
     (else (list 'LDC s)))))
 
+(secd-compile (lambda (s) (compile-expr s '())))
+
+;; a top-level form of `secd file.scm`, run by itself:
+;; (define name expr) and (define (name . args) body) bind globals
+(secd-compile-top (lambda (s)
+    (append
+      (cond
+        ((secd-not (pair? s)) (secd-compile s))
+        ((eq? (car s) 'define)
+          (let ((what (cadr s)))
+            (if (pair? what)
+              (secd-compile
+                (list 'secd-bind! (list 'quote (car what))
+                      (list 'lambda (cdr what) (cons 'begin (cdr (cdr s))))))
+              (secd-compile
+                (list 'secd-bind! (list 'quote what) (caddr s))))))
+        (else (secd-compile s)))
+      '(STOP))))
+
 (repl (lambda ()
     (let ((inp (read)))
       (if (eof-object? inp) (quit)
@@ -193,4 +281,7 @@
           (cons 'null?   (lambda (obj) (eq? obj '())))
           (cons 'number? (lambda (obj) (eq? (secd-type obj) 'int)))
           (cons 'symbol? (lambda (obj) (eq? (secd-type obj) 'sym)))))))
-  (repl)))
+  ;; secd file.scm binds *secd-source* and compiles the forms itself
+  (if (defined? '*secd-source*)
+    (secd-bind! 'secd-compile-top secd-compile-top)
+    (repl))))
@@ -3,31 +3,271 @@
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
+/* the heap starts with N_CELLS and may grow up to N_CELLS_MAX,
+ * override with -m/-M or SECD_HEAP/SECD_HEAP_MAX */
 #define N_CELLS     64 * 1024
+#define N_CELLS_MAX 16 * 1024 * 1024
+
+/* the compiler for file.scm, found next to the binary */
+#define SECDCC_BINARY   "scm2secd.secdb"
+#define SECDCC_TEXT     "scm2secd.secd"
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-m <cells>] [-M <cells>] [-j <threads>] [-o <image>] [file.secd|file.secdb]\n", prog);
+    fprintf(stderr, "       %s -b <file.secdb> [file.secd]\n", prog);
+    fprintf(stderr, "       %s [-c <compiler>] file.scm\n", prog);
+    fprintf(stderr, "       %s -i <image> [-j <threads>] [-o <image>]\n", prog);
+    fprintf(stderr, "  -m <cells>  initial heap size, e.g. 64k (SECD_HEAP)\n");
+    fprintf(stderr, "  -M <cells>  maximal heap size, e.g. 16M, 256M at most (SECD_HEAP_MAX)\n");
+    fprintf(stderr, "  -j <threads>  threads marking large heaps (SECD_GC_THREADS)\n");
+    fprintf(stderr, "  -o <image>  (secd 'image) saves the heap there\n");
+    fprintf(stderr, "  -i <image>  resume the machine saved in the heap image\n");
+    fprintf(stderr, "  -b <file.secdb>  save the compiled code, don't run it\n");
+    fprintf(stderr, "  -c <compiler>  compiles file.scm (SECD_COMPILER),\n");
+    fprintf(stderr, "                 scm2secd.secdb or scm2secd.secd next to %s by default\n", prog);
+    fprintf(stderr, "  compiled forms of file.scm are cached in SECD_CACHE (empty: off),\n");
+    fprintf(stderr, "  $XDG_CACHE_HOME/secd or ~/.cache/secd\n");
+}
+
+/* "64k", "16M": a number of cells with an optional k/M suffix */
+static size_t parse_cells(const char *s) {
+    char *end;
+    size_t n = strtoul(s, &end, 10);
+    switch (*end) {
+      case 'k': case 'K': n *= 1024; ++end; break;
+      case 'm': case 'M': n *= 1024 * 1024; ++end; break;
+    }
+    if ((end == s) || *end)
+        return 0;
+    return n;
+}
+
+static size_t cells_from_env(const char *var, size_t dflt) {
+    const char *val = getenv(var);
+    if (!val)
+        return dflt;
+    size_t n = parse_cells(val);
+    if (n == 0)
+        fprintf(stderr, "%s=%s is ignored, not a number\n", var, val);
+    return (n ? n : dflt);
+}
+
+/* file.scm is compiled form by form in the process, see secd_run_source() */
+static bool is_source(const char *path) {
+    size_t len = strlen(path);
+    return (len > 4) && !strcmp(path + len - 4, ".scm");
+}
+
+static const char *find_compiler(const char *prog) {
+    static char path[PATH_MAX];
+    const char *dirend = strrchr(prog, '/');
+    int dirlen = (dirend ? dirend - prog : 1);
+    const char *dir = (dirend ? prog : ".");
+
+    snprintf(path, sizeof(path), "%.*s/%s", dirlen, dir, SECDCC_BINARY);
+    if (access(path, R_OK) == 0)
+        return path;
+    snprintf(path, sizeof(path), "%.*s/%s", dirlen, dir, SECDCC_TEXT);
+    return path;
+}
+
+/* FNV-1a of the file contents, false if it can't be read */
+static bool file_hash(const char *path, uint64_t *hash) {
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return false;
+
+    unsigned char buf[4096];
+    size_t n, i;
+    *hash = 14695981039346656037ull;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        for (i = 0; i < n; ++i)
+            *hash = (*hash ^ buf[i]) * 1099511628211ull;
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static bool make_dir(const char *path) {
+    return (mkdir(path, 0755) == 0) || (errno == EEXIST);
+}
+
+/* the compiled forms of source are cached in SECD_CACHE (no cache if
+ * it's empty), $XDG_CACHE_HOME/secd or ~/.cache/secd, in a file named
+ * after the hashes of the source text and of the compiler */
+static const char *source_cache(const char *source, const char *compiler) {
+    static char path[PATH_MAX];
+    char dir[PATH_MAX];
+    const char *env;
+
+    if ((env = getenv("SECD_CACHE"))) {
+        if (!env[0])
+            return NULL;
+        snprintf(dir, sizeof(dir), "%s", env);
+    } else if ((env = getenv("XDG_CACHE_HOME")) && env[0]) {
+        snprintf(dir, sizeof(dir), "%s/secd", env);
+    } else if ((env = getenv("HOME")) && env[0]) {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+        if (!make_dir(dir))
+            return NULL;
+        snprintf(dir, sizeof(dir), "%s/.cache/secd", env);
+    } else {
+        return NULL;
+    }
+    if (!make_dir(dir))
+        return NULL;
+
+    uint64_t srchash, cchash;
+    if (!file_hash(source, &srchash) || !file_hash(compiler, &cchash))
+        return NULL;
+
+    int len = snprintf(path, sizeof(path), "%s/%016llx-%016llx.secdb", dir,
+                       (unsigned long long)srchash, (unsigned long long)cchash);
+    return ((size_t)len < sizeof(path) ? path : NULL);
+}
+
+/* compiled code or its text; stdin if path is NULL */
+static cell_t *read_program(secd_t *secd, const char *path) {
+    cell_t *inp = SECD_NIL;
+    if (path) {
+        inp = secdb_load(secd, path);
+        if (is_error(inp)) {
+            secd_errorf(secd, "%s\n", errmsg(inp));
+            return inp;
+        }
+    }
+    if (is_nil(inp)) {
+        cell_t *cmdport = SECD_NIL;
+        if (path)
+            cmdport = secd_fopen(secd, path, "r");
+
+        inp = sexp_parse(secd, cmdport); // cmdport is dropped after
+    }
+    if (is_nil(inp) || !is_cons(inp)) {
+        secd_errorf(secd, "list of commands expected\n");
+        dbg_printc(secd, inp);
+        return new_error(secd, SECD_NIL, "list of commands expected");
+    }
+    return inp;
+}
+
+/* reserve address space for the largest heap;
+ * pages are only backed by memory when the heap uses them */
+static cell_t *reserve_heap(size_t ncells) {
+    void *heap = mmap(NULL, sizeof(cell_t) * ncells, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap == MAP_FAILED)
+        return NULL;
+    return (cell_t *)heap;
+}
 
 int main(int argc, char *argv[]) {
     secd_t secd;
-    cell_t *heap = (cell_t *)malloc(sizeof(cell_t) * N_CELLS);
+    size_t ncells = cells_from_env("SECD_HEAP", N_CELLS);
+    size_t maxcells = cells_from_env("SECD_HEAP_MAX", N_CELLS_MAX);
+    size_t nthreads = cells_from_env("SECD_GC_THREADS", 0);
+    const char *loadimage = NULL;
+    const char *saveimage = NULL;
+    const char *savecode = NULL;
+    const char *compiler = getenv("SECD_COMPILER");
 
-    init_secd(&secd, heap, N_CELLS);
-#if ((CTRLDEBUG) || (MEMDEBUG))
-    secd_setport(&secd, SECD_STDDBG, secd_fopen(&secd, "secd.log", "w"));
+    int opt;
+    while ((opt = getopt(argc, argv, "m:M:j:i:o:b:c:")) != -1) {
+        switch (opt) {
+          case 'm': ncells = parse_cells(optarg); break;
+          case 'M': maxcells = parse_cells(optarg); break;
+          case 'j': nthreads = parse_cells(optarg); break;
+          case 'i': loadimage = optarg; break;
+          case 'o': saveimage = optarg; break;
+          case 'b': savecode = optarg; break;
+          case 'c': compiler = optarg; break;
+          default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if ((ncells == 0) || (maxcells == 0) || (argc - optind > (loadimage ? 0 : 1))) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+#if (COMPACTCONS)
+    if ((ncells > HEAP_CELLS_MAX) || (maxcells > HEAP_CELLS_MAX)) {
+        fprintf(stderr, "the heap takes %zu cells at most\n", (size_t)HEAP_CELLS_MAX);
+        return EXIT_FAILURE;
+    }
 #endif
 
-    cell_t *cmdport = SECD_NIL;
-    if (argc == 2)
-        cmdport = secd_fopen(&secd, argv[1], "r");
-
-    cell_t *inp = sexp_parse(&secd, cmdport); // cmdport is dropped after
-    if (is_nil(inp) || !is_cons(inp)) {
-        secd_errorf(&secd, "list of commands expected\n");
-        dbg_printc(&secd, inp);
-        return 1;
+    const char *program = (optind < argc ? argv[optind] : NULL);
+    const char *source = NULL;
+    if (program && is_source(program)) {
+        if (savecode) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (access(program, R_OK) != 0) {
+            fprintf(stderr, "%s: %s\n", program, strerror(errno));
+            return EXIT_FAILURE;
+        }
+        source = program;
+        program = (compiler ? compiler : find_compiler(argv[0]));
     }
 
     cell_t *ret;
-    ret = run_secd(&secd, inp);
+    if (loadimage) {
+        /* the heap and its sizes are the image's */
+        if (!secd_load_image(&secd, loadimage))
+            return EXIT_FAILURE;
+        secd.imagepath = saveimage;
+        if (nthreads)
+            secd.markthreads = nthreads;
+
+        ret = secd_resume(&secd);
+    } else {
+        if (maxcells < ncells)
+            maxcells = ncells;
+
+        cell_t *heap = reserve_heap(maxcells);
+        if (!heap) {
+            fprintf(stderr, "failed to reserve a heap of %zu cells\n", maxcells);
+            return EXIT_FAILURE;
+        }
+
+        init_secd(&secd, heap, maxcells);
+        secd_set_heapsize(&secd, ncells);
+        secd.imagepath = saveimage;
+        if (nthreads)
+            secd.markthreads = nthreads;
+#if ((CTRLDEBUG) || (MEMDEBUG))
+        secd_setport(&secd, SECD_STDDBG, secd_fopen(&secd, "secd.log", "w"));
+#endif
+
+        const char *cachepath = (source ? source_cache(source, program) : NULL);
+        cell_t *forms = (cachepath ? secdb_load(&secd, cachepath) : SECD_NIL);
+        if (not_nil(forms) && !is_error(forms)) {
+            /* the source and the compiler are the same, nothing to compile */
+            ret = secd_run_compiled(&secd, forms);
+        } else {
+            cell_t *inp = read_program(&secd, program);
+            if (is_error(inp))
+                return EXIT_FAILURE;
+
+            if (savecode)
+                return (secdb_write(&secd, inp, savecode) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+            if (source)
+                ret = secd_run_source(&secd, inp, source, cachepath);
+            else
+                ret = run_secd(&secd, inp);
+        }
+    }
+#if (OPSTATS)
+    secd_print_opstats(&secd);
+#endif
 
     return (is_error(ret) ? EXIT_FAILURE : EXIT_SUCCESS);
 }
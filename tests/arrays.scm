@@ -0,0 +1,20 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (make-all n acc) (if (eq? n 0) acc (make-all (- n 1) (cons (make-vector (remainder (* n 7) 37) n) acc))))
+(define (sizes vs) (map vector-length vs))
+(define vs (make-all 60 '()))
+(sizes vs)
+(define (strings n acc) (if (eq? n 0) acc (strings (- n 1) (cons (list->string (map (lambda (k) (integer->char (+ 65 (remainder k 26)))) (iota (remainder (* n 13) 41) (quote ())))) acc))))
+(define ss (strings 50 '()))
+(list (car ss) (string-length (car (reverse ss))))
+(define (churn n) (if (eq? n 0) 'done (begin (make-all 30 '()) (strings 30 '()) (churn (- n 1)))))
+(churn 100)
+(define long-string (list->string (map (lambda (n) (integer->char (+ 97 (remainder n 26)))) (iota 300 '()))))
+(string-length long-string)
+(string-ref long-string 299)
+(define v (list->vector (iota 1000 '())))
+(list (vector-length v) (vector-ref v 0) (vector-ref v 999))
+(map (lambda (v) (vector-ref v 0)) (list (car vs) (cadr vs) (car (reverse vs))))
+(equal? ss (strings 50 '()))
+(vector->list (make-vector 3 "s"))
+(bytevector-length (make-bytevector 100 0))
+(string->symbol (list->string (string->list "interned")))
@@ -0,0 +1,9 @@
+(define (leak) (letrec ((f (lambda () g)) (g (lambda () f))) 'leaked))
+(define (churn n) (if (eq? n 0) 'done (begin (leak) (churn (- n 1)))))
+(churn 20000)
+(define policy (secd 'gcpolicy))
+(list (car policy) (cadr policy) (> (caddr policy) 0))
+(cdr (reverse (secd 'gcpolicy 4096 50)))
+(churn 20000)
+(secd 'gcpolicy 'often)
+(secd 'gcpolicy 4096 100)
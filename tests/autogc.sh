@@ -0,0 +1,3 @@
+# leaked closure cycles fill a heap that can't grow,
+# the collector runs by itself at safe points
+$VM -m 64k -M 64k $REPL < tests/autogc.scm 2>&1
@@ -0,0 +1,24 @@
+# compiled forms of a source are cached by the hashes of the source
+# and of the compiler; a changed source gets another cache file,
+# a failing source is not cached
+dir=$(mktemp -d)
+SECD_CACHE=$dir/cache
+export SECD_CACHE
+
+echo "(define (sq x) (* x x)) (display (sq 7))" > $dir/a.scm
+$VM $dir/a.scm 2>&1; echo
+ls $dir/cache | wc -l
+$VM $dir/a.scm 2>&1; echo
+ls $dir/cache | wc -l
+
+echo "(define (sq x) (+ x x)) (display (sq 7))" > $dir/a.scm
+$VM $dir/a.scm 2>&1; echo
+ls $dir/cache | wc -l
+
+echo "(display (undefined-function 1))" > $dir/b.scm
+$VM $dir/b.scm 2>&1 | sed '/^;;Environment/,$d'
+ls $dir/cache | wc -l
+
+SECD_CACHE= $VM $dir/a.scm 2>&1; echo
+ls $dir/cache | wc -l
+rm -rf $dir
@@ -0,0 +1,16 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (word n) (list->string (map (lambda (k) (integer->char (+ 97 (remainder (+ n k) 26)))) (iota (+ 1 (remainder n 9)) '()))))
+(define (blocks n acc) (if (eq? n 0) acc (blocks (- n 1) (cons (make-vector (+ 5 (remainder n 17)) n) (cons (word n) (cons (make-vector 3 0) acc))))))
+(define (every-other xs) (if (null? xs) '() (if (null? (cdr xs)) xs (cons (car xs) (every-other (cddr xs))))))
+(define kept (every-other (every-other (blocks 300 '()))))
+(length kept)
+(define sym (string->symbol (word 5)))
+sym
+(secd 'gc)
+(define (check xs) (if (null? xs) 0 (+ (if (vector? (car xs)) (vector-ref (car xs) (- (vector-length (car xs)) 1)) (string-length (car xs))) (check (cdr xs)))))
+(check kept)
+(map (lambda (x) x) (list (car kept) (cadr kept) (car (reverse kept))))
+(eq? sym (string->symbol (word 5)))
+(define big (make-vector 3000 'big))
+(vector-ref big 2999)
+(check kept)
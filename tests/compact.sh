@@ -0,0 +1,4 @@
+# (secd 'gc) compacts a fragmented array heap: vectors, strings and
+# interned symbols are read back after their arrays have moved
+$VM $REPL < tests/compact.scm 2>&1
+echo "(secd 'mem)" | cat tests/compact.scm - | $VM $REPL 2>&1 | grep -o "[0-9]* compactions"
@@ -0,0 +1,20 @@
+(define foo 1)
+(define foo car)
+(foo '(1 2))
+(define bar "str")
+(define bar (lambda (x) (* x x)))
+(bar 7)
+(cons 1 2)
+(cons '() '())
+(cons "a string" #\c)
+((cdr (cons car cdr)) '(1 2))
+((car (cons (lambda (x) x) 'sym)) 42)
+(define p (cons (make-vector 2 'v) (list 1 2 3)))
+p
+(cdr p)
+(define (zip a b) (if (null? a) '() (cons (cons (car a) (car b)) (zip (cdr a) (cdr b)))))
+(zip '(1 2 3) '(a b c))
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(length (iota 20000 '()))
+(append '(1 2) '(3 . 4))
+(let ((x 1) (y "two") (z '(3))) (list x y z))
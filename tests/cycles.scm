@@ -0,0 +1,12 @@
+(secd 'gcpolicy 0)
+(define (leak) (letrec ((f (lambda () g)) (g (lambda () f))) 'leaked))
+(define (churn n) (if (eq? n 0) 'done (begin (leak) (churn (- n 1)))))
+(define parity
+  (letrec ((ev? (lambda (n) (if (eq? n 0) #t (od? (- n 1)))))
+           (od? (lambda (n) (if (eq? n 0) #f (ev? (- n 1))))))
+    ev?))
+(define (batch n) (if (eq? n 0) 'ok (begin (churn 500) (secd 'cycles) (batch (- n 1)))))
+(batch 30)
+(parity 1001)
+(parity 1000)
+((lambda () (letrec ((loop (lambda (n) (if (eq? n 0) 'inner (loop (- n 1)))))) (loop 10))))
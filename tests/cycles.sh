@@ -0,0 +1,4 @@
+# with automatic collection off, closure cycles leaked by letrec
+# fill a 128k heap unless (secd 'cycles) collects them;
+# a live cycle is kept
+$VM -m 128k -M 128k $REPL < tests/cycles.scm 2>&1
@@ -0,0 +1,12 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (nest n acc) (if (eq? n 0) acc (nest (- n 1) (list acc))))
+(define (depth t d) (if (pair? t) (depth (car t) (+ d 1)) d))
+(define long (iota 150000 '()))
+(define deep (nest 100000 'leaf))
+(define vec (list->vector (iota 50000 '())))
+(secd 'gc)
+(length long)
+(depth deep 0)
+(vector-ref vec 49999)
+(secd 'gc)
+(list (car (reverse long)) (cdr deep) (vector-length vec))
@@ -0,0 +1,20 @@
+# secd file.scm compiles each top-level form with scm2secd and runs it
+$VM tests/append.scm 2>&1
+echo
+src=$(mktemp --suffix=.scm)
+cat > $src <<'END'
+(define (fact n) (if (eq? n 0) 1 (* n (fact (- n 1)))))
+(define (loop n acc) (if (eq? n 0) acc (loop (- n 1) (+ acc 1))))
+(display (fact 10))
+(display (loop 100000 0))
+(display (letrec ((ev? (lambda (n) (if (eq? n 0) 'yes (od? (- n 1)))))
+                  (od? (lambda (n) (if (eq? n 0) 'no (ev? (- n 1))))))
+           (list (ev? 10) (ev? 7))))
+END
+$VM $src 2>&1
+echo
+$VM -c scm2secd.secd $src 2>&1
+echo
+$VM tests/no-such-file.scm 2>&1
+echo "exit status: $?"
+rm -f $src
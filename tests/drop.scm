@@ -0,0 +1,11 @@
+(secd 'gcpolicy 0)
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (nest n acc) (if (eq? n 0) acc (nest (- n 1) (list acc))))
+(define (round n) (if (eq? n 0) 'done (begin (length (iota 100000 '())) (nest 50000 'leaf) (round (- n 1)))))
+(round 3)
+(define long (iota 100000 '()))
+(define long '())
+(define deep (nest 100000 'leaf))
+(define deep 'gone)
+(length (iota 100000 '()))
+(list long deep)
@@ -0,0 +1,4 @@
+# long lists and deep trees are dropped into the dead queue and freed
+# over the next allocations, with automatic collection off, in a heap
+# that can't hold two of them
+$VM -m 192k -M 192k $REPL < tests/drop.scm 2>&1
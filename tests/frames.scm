@@ -0,0 +1,31 @@
+;; closure frames keep their values in one array
+(define (many a b c d e f g h i j) (list j i h g f e d c b a))
+(many 1 2 3 4 5 6 7 8 9 10)
+
+;; rest arguments
+(define (all . args) args)
+(all)
+(all 1 2 3)
+(define (head+rest a . rest) (list a rest))
+(head+rest 1)
+(head+rest 1 2 3)
+(secd-apply many '(a b c d e f g h i j))
+
+;; frames outlive their calls in closures
+(define (counter-list n)
+  (if (eq? n 0) '()
+      (cons (lambda () n) (counter-list (- n 1)))))
+(map (lambda (f) (f)) (counter-list 5))
+
+;; frames of the calls a continuation escapes from
+(define (capture x) (+ x (call/cc (lambda (k) (k 5)))))
+(capture 10)
+(define (find-first pred xs)
+  (call/cc (lambda (return)
+    (for-each (lambda (x) (if (pred x) (return x) #f)) xs)
+    #f)))
+(find-first (lambda (x) (eq? (remainder x 7) 0)) '(1 5 9 14 21))
+
+;; the wrong number of arguments
+(many 1 2)
+((lambda (x) x))
@@ -0,0 +1,24 @@
+(secd-compile '(lambda (x y) (if (eq? x y) (car x) (car (cdr (cdr y))))))
+(define (first x) (car x))
+(define (rest x) (cdr x))
+(define (third x) (car (cdr (cdr x))))
+(define (same? a b) (if (eq? a b) 'yes 'no))
+(define (le? a b) (if (<= a b) 'le 'gt))
+(define (dec n) (- n 1))
+(first '(1 2 3))
+(rest '(1 2 3))
+(third '(1 2 3))
+(same? 'a 'a)
+(same? 'a 'b)
+(same? '() '())
+(le? 1 2)
+(le? 2 1)
+(le? 2 2)
+(dec 10)
+(first 5)
+(rest '())
+(third '(1))
+(le? 'a 1)
+(dec 'a)
+(same? 1)
+(first '(ok))
@@ -0,0 +1,21 @@
+(define (f) 1)
+(define (call-f) (f))
+(call-f)
+(define (f) 2)
+(call-f)
+(define x 10)
+(define (get-x) x)
+(get-x)
+(define x 20)
+(get-x)
+(define (shadow x) (list x (get-x)))
+(shadow 5)
+(let ((x 7)) (list x (get-x)))
+(define car-alias car)
+(car-alias '(1 2))
+(define car-alias cdr)
+(car-alias '(1 2))
+(undefined-global 1)
+(define undefined-global (lambda (n) (+ n 1)))
+(undefined-global 1)
+(load "tests/no-such-file.scm")
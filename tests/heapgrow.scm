@@ -0,0 +1,9 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define big (iota 200000 '()))
+(length big)
+(car (reverse big))
+(define (vectors n acc) (if (eq? n 0) acc (vectors (- n 1) (cons (make-vector 1000 n) acc))))
+(define vs (vectors 300 '()))
+(vector-ref (car vs) 999)
+(length vs)
+(length big)
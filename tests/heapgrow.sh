@@ -0,0 +1,5 @@
+# a 64k heap grows for 200k live conses and 300k cells of vectors;
+# the sizes come from the options or from the environment, and a heap
+# that can't grow any more fails with an error
+$VM -m 64k $REPL < tests/heapgrow.scm 2>&1
+SECD_HEAP=64k SECD_HEAP_MAX=128k $VM $REPL < tests/heapgrow.scm 2>&1
@@ -0,0 +1,6 @@
+# with COMPACTCONS half cells refer to each other by 32-bit
+# references, the heap can't be larger than they reach
+# (tests/compact/heaplimit.out); full cells have no such limit
+echo "(LDC ok PRINT STOP)" | $VM -M 300M 2>&1
+echo "(LDC ok PRINT STOP)" | $VM -m 300M 2>&1
+echo "(LDC ok PRINT STOP)" | $VM -m 64k -M 256M 2>&1
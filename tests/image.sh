@@ -0,0 +1,20 @@
+# secd -o saves the REPL heap after its prelude, secd -i resumes it;
+# (secd 'image) saves a session with its definitions
+img=$(mktemp)
+img2=$(mktemp)
+$VM -o $img $REPL < /dev/null 2>&1
+$VM -i $img -o $img2 2>&1 <<'END'
+(define (sq x) (* x x))
+(define data (list 1 "two" #\3 (vector 4) 'sym))
+(secd 'image)
+(sq 12)
+END
+echo
+$VM -i $img2 2>&1 <<'END'
+(sq 9)
+data
+(define (cube x) (* x (sq x)))
+(cube 3)
+(eq? (car (reverse data)) 'sym)
+END
+rm -f $img $img2
@@ -0,0 +1,24 @@
+(+ 2147483646 1)
+(- -2147483647 1)
+(* 46341 46340)
+(- 0 536870912)
+(+ 536870911 1)
+(eq? 1000000 (* 1000 1000))
+(eq? #\a #\a)
+(eq? 65 #\A)
+(char->integer #\A)
+(integer->char 955)
+(list #\a #\space 1 -1 0)
+(define v (make-vector 3 0))
+(vector-set! v 0 123456789)
+(vector-set! v 1 #\z)
+(vector-set! v 2 (- 0 7))
+v
+(+ (vector-ref v 0) (vector-ref v 2))
+(vector-ref v 1)
+(equal? '(1 #\x (2)) (list 1 #\x (list 2)))
+(remainder -17 5)
+(define (sum n acc) (if (eq? n 0) acc (sum (- n 1) (+ acc n))))
+(sum 50000 0)
+(number? #\a)
+(char? 97)
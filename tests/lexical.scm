@@ -0,0 +1,27 @@
+;; variables bound by lambda are loaded by (depth . index),
+;; globals by name
+(secd-compile '(lambda (x y) (lambda (z) (cons x (cons y z)))))
+(secd-compile '(lambda (f) (f x)))
+
+(define x 'global)
+(define (f x) (lambda (y) (list x y)))
+((f 'outer) 'inner)
+x
+
+;; shadowing: the innermost binding wins
+(define (g x) ((lambda (x) x) (+ x 1)))
+(g 1)
+(let ((x 1)) (let ((y 2)) (let ((x 3)) (list x y))))
+
+;; three frames out
+(define (h a) (lambda (b) (lambda (c) (lambda (d) (list a b c d)))))
+((((h 1) 2) 3) 4)
+
+;; letrec and internal defines
+(letrec ((even? (lambda (n) (if (eq? n 0) #t (odd? (- n 1)))))
+         (odd? (lambda (n) (if (eq? n 0) #f (even? (- n 1))))))
+  (list (even? 10) (odd? 7)))
+(define (k n)
+  (define m (* n 2))
+  (+ m 1))
+(k 20)
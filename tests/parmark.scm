@@ -0,0 +1,11 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (nest n acc) (if (eq? n 0) acc (nest (- n 1) (list acc n))))
+(define a (iota 150000 '()))
+(define t (nest 60000 'leaf))
+(define v (list->vector (iota 30000 '())))
+(define (garbage n) (if (eq? n 0) 'done (begin (iota 100 '()) (garbage (- n 1)))))
+(garbage 500)
+(secd 'gc)
+(garbage 500)
+(secd 'gc)
+(list (length a) (car (reverse a)) (cadr t) (vector-ref v 29999) (length (vector->list v)))
@@ -0,0 +1,8 @@
+# a heap of more than MARK_PARALLEL cells is marked by one thread
+# and by four; both keep the same cells
+out1=$(mktemp)
+out4=$(mktemp)
+$VM -m 512k -j 1 $REPL < tests/parmark.scm > $out1 2>&1
+$VM -m 512k -j 4 $REPL < tests/parmark.scm > $out4 2>&1
+cmp $out1 $out4 && tail -3 $out4
+rm -f $out1 $out4
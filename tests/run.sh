@@ -0,0 +1,43 @@
+#!/bin/sh
+# tests/run.sh [VM [REPL [VARIANT]]]: runs every test that has an expected
+# output tests/NAME.out; the test is tests/NAME.sh (run by sh with $VM and
+# $REPL set), tests/NAME.secd (run by the VM) or tests/NAME.scm (typed
+# into the REPL); stdout and stderr are compared with NAME.out, or with
+# tests/VARIANT/NAME.out if the VM is built differently and it exists
+cd "$(dirname "$0")/.."
+
+VM=${1:-./secd}
+REPL=${2:-repl.secd}
+VARIANT=${3:-}
+SECD_CACHE=
+export VM REPL SECD_CACHE
+
+result=$(mktemp)
+trap 'rm -f $result' EXIT
+
+npassed=0
+nfailed=0
+for expected in tests/*.out; do
+    name=${expected%.out}
+    if [ -f $name.sh ]; then
+        sh $name.sh > $result 2>&1
+    elif [ -f $name.secd ]; then
+        $VM $name.secd < /dev/null > $result 2>&1
+    else
+        $VM $REPL < $name.scm > $result 2>&1
+    fi
+
+    if [ -n "$VARIANT" ] && [ -f tests/$VARIANT/${name#tests/}.out ]; then
+        expected=tests/$VARIANT/${name#tests/}.out
+    fi
+
+    if diff -u $expected $result; then
+        npassed=$((npassed + 1))
+    else
+        echo "FAIL: $name"
+        nfailed=$((nfailed + 1))
+    fi
+done
+
+echo "$npassed passed, $nfailed failed${VARIANT:+ ($VARIANT)}"
+[ $nfailed -eq 0 ]
@@ -0,0 +1,12 @@
+# secd -b saves compiled code as .secdb; loading it runs the same
+# program as the text it was made from
+db=$(mktemp)
+$VM -b $db tests/flatcode.secd 2>&1
+$VM $db < /dev/null 2>&1
+echo
+$VM -b $db $REPL 2>&1
+echo "(map (lambda (x) (* x x)) '(1 2 3))" | $VM $db 2>&1
+echo
+echo "(LDC (x . y) CDR PRINT LDC \"str\" PRINT STOP)" | $VM -b $db 2>&1
+$VM $db < /dev/null 2>&1
+rm -f $db
@@ -0,0 +1,13 @@
+(define (count-up n) (if (eq? n 0) 0 (+ 1 (count-up (- n 1)))))
+(count-up 10000)
+(define (build n) (if (eq? n 0) '() (cons n (build (- n 1)))))
+(length (build 5000))
+(+ 1 (call/cc (lambda (k) (+ 100 (k 2)))))
+(define (deep n) (if (eq? n 0) (call/cc (lambda (k) (k 0))) (+ 1 (deep (- n 1)))))
+(deep 3000)
+(define (product xs)
+  (call/cc (lambda (break)
+    (letrec ((loop (lambda (ys) (if (null? ys) 1 (if (eq? (car ys) 0) (break 0) (* (car ys) (loop (cdr ys)))))))) (loop xs)))))
+(product '(1 2 3 4 5))
+(product '(1 2 0 4 5))
+(list 1 (call/cc (lambda (k) 2)) 3)
@@ -0,0 +1,16 @@
+(define (iota n acc) (if (eq? n 0) acc (iota (- n 1) (cons n acc))))
+(define (sum xs acc) (if (null? xs) acc (sum (cdr xs) (+ acc (car xs)))))
+(define live (iota 20000 '()))
+(define (garbage n) (if (eq? n 0) 'done (begin (iota 50 '()) (garbage (- n 1)))))
+(garbage 1000)
+(secd 'gc)
+(define more (iota 5000 '()))
+(secd 'gc)
+(secd 'gc)
+(list (sum live 0) (sum more 0))
+(cdr (reverse (secd 'gcpolicy 1024 50)))
+(define (mixed n acc) (if (eq? n 0) acc (begin (iota 20 '()) (mixed (- n 1) (cons (make-vector 2 n) acc)))))
+(define vs (mixed 3000 '()))
+(garbage 1000)
+(list (sum live 0) (sum more 0) (length vs) (vector-ref (car vs) 1) (vector-ref (car (reverse vs)) 0))
+(> (caddr (secd (quote gcpolicy))) 3)
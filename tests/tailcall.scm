@@ -0,0 +1,14 @@
+(secd-compile '(lambda (n) (if (eq? n 0) 'done (loop (- n 1)))))
+(secd-compile '(lambda (n) (begin (display n) (f n))))
+(secd-compile '(begin (display 1) 2))
+(define (loop n acc) (if (eq? n 0) acc (loop (- n 1) (+ acc 1))))
+(loop 100000 0)
+(define (even2? n) (if (eq? n 0) #t (odd2? (- n 1))))
+(define (odd2? n) (if (eq? n 0) #f (even2? (- n 1))))
+(even2? 50001)
+(define (f n) (cond ((eq? n 0) 'end) (else (f (- n 1)))))
+(f 50000)
+(define (g n) (let ((m (- n 1))) (if (eq? m 0) 'bottom (g m))))
+(g 50000)
+(define (seq n) (begin (+ n 1) n))
+(seq 5)
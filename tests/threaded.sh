@@ -0,0 +1,15 @@
+# opcodes run inline by the threaded loop leave what they can't do
+# to the generic handlers: the results and the errors are the same
+for code in "(CAR STOP)" "(CDR STOP)" "(CDR CAR STOP)" "(LDC 1 CAR PRINT STOP)" \
+            "(LDC x LDC 1 ADD STOP)" "(LDC 1 EQ STOP)"
+do
+    echo "$code" | $VM 2>&1 | sed '/^;;Environment/,$d'
+done
+
+echo "(LDC (1 2)  CDR CAR  PRINT
+      LDC 2  LDC 2  EQ  PRINT
+      LDC a  LDC b  EQ  PRINT
+      LDC ()  LDC ()  EQ  PRINT
+      LDC 2  LDC 3  ADD  PRINT
+      LDC 3  LDC 2  LEQ  SEL (LDC le JOIN) (LDC gt JOIN)  PRINT
+      STOP)" | $VM
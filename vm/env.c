@@ -12,8 +12,18 @@ static hash_t stddbghash;
 
 /*
  *  Environment
+ *
+ *  A frame is (symlist . values). The global frame keeps its values
+ *  in a list, so that it can be extended by secd-bind!. Frames made
+ *  by setup_frame() are vector frames: the values are CELL_REFs in
+ *  one array, the symlist is shared with the function arguments.
+ *  A rest argument takes one value/slot for the list of the rest.
  */
 
+static inline bool is_vector_frame(const cell_t *frame) {
+    return cell_type(get_cdr(frame)) == CELL_ARRAY;
+}
+
 void secd_print_env(secd_t *secd) {
     cell_t *env = secd->env;
     int i = 0;
@@ -21,17 +31,23 @@ void secd_print_env(secd_t *secd) {
     while (not_nil(env)) {
         secd_printf(secd, ";;  Frame #%d:\n", i++);
         cell_t *frame = get_car(env);
+        if (is_nil(frame)) {
+            /* omega-frame */
+            env = list_next(secd, env);
+            continue;
+        }
         cell_t *symlist = get_car(frame);
         cell_t *vallist = get_cdr(frame);
+        cell_t *slot = (is_vector_frame(frame) ? arr_mem(vallist) : SECD_NIL);
 
         while (not_nil(symlist)) {
             if (is_symbol(symlist)) {
                 secd_printf(secd, ";;  . %s\t=>\t", symname(symlist));
-                dbg_print_cell(secd, vallist);
+                dbg_print_cell(secd, (slot ? slot->as.ref : vallist));
                 break;
             }
             cell_t *sym = get_car(symlist);
-            cell_t *val = get_car(vallist);
+            cell_t *val = (slot ? slot->as.ref : get_car(vallist));
             if (!is_symbol(sym)) {
                 errorf("print_env: not a symbol at *%p in symlist\n", sym);
                 dbg_printc(secd, sym);
@@ -40,13 +56,108 @@ void secd_print_env(secd_t *secd) {
             dbg_print_cell(secd, val);
 
             symlist = list_next(secd, symlist);
-            vallist = list_next(secd, vallist);
+            if (slot) ++slot;
+            else vallist = list_next(secd, vallist);
         }
 
         env = list_next(secd, env);
     }
 }
 
+/*
+ *  Global bindings
+ *
+ *  The global frame is indexed by secd->globals, a hash table of
+ *  (sym . binding) chains, where the binding is the cons of the frame
+ *  value list holding the value of sym. A symbol is bound only once
+ *  in the global frame: secd-bind! of a bound symbol replaces the value
+ *  in its binding, so a binding found once may be cached.
+ */
+
+static const unsigned GLOBALS_MAX_LOAD_RATIO = 70; // percent
+static const size_t GLOBALS_INIT_CAPACITY = 64;
+
+static inline bool is_global_frame(secd_t *secd, const cell_t *frame) {
+    return frame == get_car(secd->global_env);
+}
+
+static cell_t *new_globals_table(secd_t *secd, size_t hashcap) {
+    cell_t *hasharr = new_array(secd, hashcap);
+    assert_cell(hasharr, "new_globals_table: failed to allocate");
+
+    size_t i;
+    for (i = 0; i < hashcap; ++i)
+        init_arr_ref(secd, arr_ref(hasharr, i), SECD_NIL);
+    return hasharr;
+}
+
+static void globals_insert(secd_t *secd, cell_t *hasharr, cell_t *entry) {
+    size_t hashcap = arr_size(secd, hasharr);
+    cell_t *bucket = arr_ref(hasharr, symhash(get_car(entry)) % hashcap);
+
+    cell_t *chain = new_cons(secd, entry, bucket->as.ref);
+    drop_cell(secd, bucket->as.ref);
+    bucket->as.ref = share_cell(secd, chain);
+}
+
+static void globals_rehash(secd_t *secd, size_t newhashcap) {
+    cell_t *oldarr = secd->globals;
+    cell_t *newarr = new_globals_table(secd, newhashcap);
+
+    size_t i;
+    size_t hashcap = arr_size(secd, oldarr);
+    for (i = 0; i < hashcap; ++i) {
+        cell_t *chain = arr_ref(oldarr, i)->as.ref;
+        while (not_nil(chain)) {
+            globals_insert(secd, newarr, get_car(chain));
+            chain = list_next(secd, chain);
+        }
+    }
+
+    secd->globals = share_cell(secd, newarr);
+    drop_cell(secd, oldarr);
+}
+
+/* returns the (sym . binding) entry for the symbol or NIL */
+static cell_t *globals_entry(secd_t *secd, const char *symbol, hash_t symh) {
+    cell_t *hasharr = secd->globals;
+    size_t hashcap = arr_size(secd, hasharr);
+
+    cell_t *chain = arr_ref(hasharr, symh % hashcap)->as.ref;
+    while (not_nil(chain)) {
+        cell_t *entry = get_car(chain);
+        cell_t *sym = get_car(entry);
+        if ((symh == symhash(sym)) && str_eq(symbol, symname(sym)))
+            return entry;
+        chain = list_next(secd, chain);
+    }
+    return SECD_NIL;
+}
+
+static void globals_add(secd_t *secd, cell_t *sym, cell_t *binding) {
+    size_t hashcap = arr_size(secd, secd->globals);
+    if (((100 * (secd->nglobals + 1)) / hashcap) > GLOBALS_MAX_LOAD_RATIO)
+        globals_rehash(secd, 2 * hashcap);
+
+    globals_insert(secd, secd->globals, new_cons(secd, sym, binding));
+    ++secd->nglobals;
+}
+
+/* index the frame lists, the first binding of a symbol is found */
+static void globals_index_frame(secd_t *secd, cell_t *frame) {
+    cell_t *symlist = get_car(frame);
+    cell_t *vallist = get_cdr(frame);
+
+    while (not_nil(symlist)) {
+        cell_t *sym = get_car(symlist);
+        if (is_nil(globals_entry(secd, symname(sym), symhash(sym))))
+            globals_add(secd, sym, vallist);
+
+        symlist = list_next(secd, symlist);
+        vallist = list_next(secd, vallist);
+    }
+}
+
 cell_t *make_native_frame(secd_t *secd,
                           const native_binding_t *binding)
 {
@@ -57,8 +168,9 @@ cell_t *make_native_frame(secd_t *secd,
     for (i = 0; binding[i].name; ++i) {
         cell_t *sym = new_symbol(secd, binding[i].name);
         cell_t *val = new_const_clone(secd, binding[i].val);
-        if (not_nil(val))
-            sym->nref = val->nref = DONT_FREE_THIS;
+        sym->nref = DONT_FREE_THIS;
+        if (not_nil(val) && !is_immediate(val))
+            val->nref = DONT_FREE_THIS;
         symlist = new_cons(secd, sym, symlist);
         vallist = new_cons(secd, val, vallist);
     }
@@ -66,23 +178,33 @@ cell_t *make_native_frame(secd_t *secd,
     return new_frame(secd, symlist, vallist);
 }
 
-void secd_init_env(secd_t *secd) {
-    /* initialize global values */
+/* the environment itself is in the heap, a machine
+ * loaded from an image only needs these */
+void secd_restore_env(secd_t __unused *secd) {
     stdinhash = secd_strhash(SECD_FAKEVAR_STDIN);
     stdouthash = secd_strhash(SECD_FAKEVAR_STDOUT);
     stddbghash = secd_strhash(SECD_FAKEVAR_STDDBG);
+}
+
+void secd_init_env(secd_t *secd) {
+    /* initialize global values */
+    secd_restore_env(secd);
 
     /* initialize the first frame */
     cell_t *frame = make_native_frame(secd, native_functions);
 
     cell_t *frame_io = new_cons(secd, secd->input_port, secd->output_port);
-    frame->as.frame.io = share_cell(secd, frame_io);
+    set_frame_io(secd, frame, share_cell(secd, frame_io));
 
     /* ready */
     cell_t *env = new_cons(secd, frame, SECD_NIL);
 
     secd->env = share_cell(secd, env);
     secd->global_env = secd->env;
+
+    secd->globals = share_cell(secd, new_globals_table(secd, GLOBALS_INIT_CAPACITY));
+    secd->nglobals = 0;
+    globals_index_frame(secd, frame);
 }
 
 static cell_t *lookup_fake_variables(secd_t *secd, const char *sym) {
@@ -96,7 +218,12 @@ static cell_t *lookup_fake_variables(secd_t *secd, const char *sym) {
     return SECD_NIL;
 }
 
-cell_t *lookup_env(secd_t *secd, const char *symbol, cell_t **symc) {
+/* for a global variable also returns its binding
+ * and the depth of the global frame in *binding, *depth */
+static cell_t *
+lookup_env_frames(secd_t *secd, const char *symbol, cell_t **symc,
+                  cell_t **binding, long *depth)
+{
     cell_t *env = secd->env;
     assert(cell_type(env) == CELL_CONS,
             "lookup_env: environment is not a list");
@@ -106,23 +233,37 @@ cell_t *lookup_env(secd_t *secd, const char *symbol, cell_t **symc) {
         return res;
 
     hash_t symh = secd_strhash(symbol);
+    long envdepth = 0;
 
-    while (not_nil(env)) {       // walk through frames
+    for (; not_nil(env); env = list_next(secd, env), ++envdepth) {
         cell_t *frame = get_car(env);
         if (is_nil(frame)) {
             /* skip omega-frame */
-            env = list_next(secd, env);
             continue;
         }
 
+        if (is_global_frame(secd, frame)) {
+            cell_t *entry = globals_entry(secd, symbol, symh);
+            if (is_nil(entry))
+                continue;
+
+            if (symc != NULL) *symc = get_car(entry);
+            if (binding != NULL) {
+                *binding = get_cdr(entry);
+                *depth = envdepth;
+            }
+            return get_car(get_cdr(entry));
+        }
+
         cell_t *symlist = get_car(frame);
         cell_t *vallist = get_cdr(frame);
+        cell_t *slot = (is_vector_frame(frame) ? arr_mem(vallist) : SECD_NIL);
 
         while (not_nil(symlist)) {   // walk through symbols
             if (is_symbol(symlist)) {
                 if (symh == symhash(symlist) && str_eq(symbol, symname(symlist))) {
                     if (symc != NULL) *symc = symlist;
-                    return vallist;
+                    return (slot ? slot->as.ref : vallist);
                 }
                 break;
             }
@@ -134,19 +275,71 @@ cell_t *lookup_env(secd_t *secd, const char *symbol, cell_t **symc) {
 
             if (symh == symhash(curc) && str_eq(symbol, symname(curc))) {
                 if (symc != NULL) *symc = curc;
-                return get_car(vallist);
+                return (slot ? slot->as.ref : get_car(vallist));
             }
 
             symlist = list_next(secd, symlist);
-            vallist = list_next(secd, vallist);
+            if (slot) ++slot;
+            else vallist = list_next(secd, vallist);
         }
-
-        env = list_next(secd, env);
     }
     //errorf(";; error in lookup_env(): %s not found\n", symbol);
     return new_error(secd, SECD_NIL, "Lookup failed for: '%s'", symbol);
 }
 
+cell_t *lookup_env(secd_t *secd, const char *symbol, cell_t **symc) {
+    return lookup_env_frames(secd, symbol, symc, NULL, NULL);
+}
+
+/* an LD site caches the global binding it has found and the depth
+ * of the global frame: cache[0] is the depth (-1 if empty),
+ * cache[1] is a reference to the binding. As LDV does, this relies
+ * on a code vector always running in environments of the same shape,
+ * the cache is used while the global frame is at the same depth */
+cell_t *lookup_env_cached(secd_t *secd, cell_t *sym, cell_t *cache, cell_t **symc) {
+    long depth = cache[0].as.num;
+    if (depth >= 0) {
+        cell_t *env = secd->env;
+        while (not_nil(env) && (depth-- > 0))
+            env = get_cdr(env);
+
+        if (env == secd->global_env) {
+            *symc = sym;
+            return get_car(cache[1].as.ref);
+        }
+    }
+
+    cell_t *binding = SECD_NIL;
+    cell_t *val = lookup_env_frames(secd, symname(sym), symc, &binding, &depth);
+    if (not_nil(binding)) {
+        cache[0].as.num = depth;
+        drop_cell(secd, cache[1].as.ref);
+        cache[1].as.ref = share_cell(secd, binding);
+    }
+    return val;
+}
+
+/* a lexical address is (depth . index): the number of frames to skip
+ * and the slot of the value in that vector frame; returns the slot
+ * (a CELL_REF to the value) or NIL if there is no such variable */
+cell_t *lookup_env_index(secd_t *secd, long depth, long index) {
+    cell_t *env = secd->env;
+
+    while (not_nil(env) && (depth-- > 0))
+        env = list_next(secd, env);
+    if (is_nil(env))
+        return SECD_NIL;
+
+    cell_t *frame = get_car(env);
+    if (is_nil(frame) || !is_vector_frame(frame))
+        return SECD_NIL;
+
+    cell_t *vals = get_cdr(frame);
+    if ((index < 0) || ((size_t)index >= arr_size(secd, vals)))
+        return SECD_NIL;
+    return arr_ref(vals, index);
+}
+
 static cell_t *
 check_io_args(secd_t *secd, cell_t *sym, cell_t *val, cell_t **args_io) {
     /* check for overriden *stdin* or *stdout* */
@@ -158,7 +351,7 @@ check_io_args(secd_t *secd, cell_t *sym, cell_t *val, cell_t **args_io) {
         if (is_nil(*args_io))
             *args_io = new_cons(secd, val, SECD_NIL);
         else
-            (*args_io)->as.cons.car = share_cell(secd, val);
+            set_car(secd, (*args_io), share_cell(secd, val));
     } else
     if ((symh == stdouthash)
         && str_eq(symname(sym), SECD_FAKEVAR_STDOUT))
@@ -167,58 +360,72 @@ check_io_args(secd_t *secd, cell_t *sym, cell_t *val, cell_t **args_io) {
         if (is_nil(*args_io))
             *args_io = new_cons(secd, SECD_NIL, val);
         else
-            (*args_io)->as.cons.cdr = share_cell(secd, val);
+            set_cdr(secd, (*args_io), share_cell(secd, val));
     }
     return SECD_NIL;
 }
 
-/* check arity;
- * possibly rewrite dot-lists into regular arguments;
- * look for overriden *stdin*|*stdout* */
+/* check arity; look for overriden *stdin*|*stdout*;
+ * returns the array of values for a vector frame */
 static cell_t *
-walk_through_arguments(secd_t *secd, cell_t *frame, cell_t **args_io) {
-    cell_t *symlist = get_car(frame);
-    cell_t *vallist = get_cdr(frame);
+new_frame_values(secd_t *secd, cell_t *argnames, cell_t *argvals, cell_t **args_io) {
+    size_t nslots = 0;
+    cell_t *symlist = argnames;
+    while (not_nil(symlist)) {
+        ++nslots;
+        if (is_symbol(symlist))
+            break;
+        symlist = list_next(secd, symlist);
+    }
+    if (nslots == 0)
+        return SECD_NIL;
 
+    cell_t *vals = new_array(secd, nslots);
+    assert_cell(vals, "new_frame_values: failed to allocate a frame");
+
+    cell_t *slot = arr_mem(vals);
+    cell_t *end = slot + nslots;
     size_t valcount = 0;
 
-    while (not_nil(symlist)) {
+    for (symlist = argnames; not_nil(symlist); ++slot) {
         if (is_symbol(symlist)) {
+            init_arr_ref(secd, slot, argvals);
             break;
         }
 
-        if (is_nil(vallist)) {
+        if (is_nil(argvals)) {
+            while (slot < end)
+                init_arr_ref(secd, slot++, SECD_NIL);
+            drop_cell(secd, share_cell(secd, vals));
+
             errorf(";; arity mismatch: %zd argument(s) is not enough\n", valcount);
             return new_error(secd, SECD_NIL,
                     "arity mismatch: %zd argument(s) is not enough", valcount);
         }
 
-        cell_t *sym = get_car(symlist);
-
-        check_io_args(secd, sym, get_car(vallist), args_io);
-
-        cell_t *nextsyms = list_next(secd, symlist);
-        cell_t *nextvals = list_next(secd, vallist);
+        cell_t *val = get_car(argvals);
+        check_io_args(secd, get_car(symlist), val, args_io);
+        init_arr_ref(secd, slot, val);
 
         ++valcount;
 
-        symlist = nextsyms;
-        vallist = nextvals;
+        symlist = list_next(secd, symlist);
+        argvals = list_next(secd, argvals);
     }
 
-    return SECD_NIL;
+    return vals;
 }
 
 /* use *args_io to override *stdin* | *stdout* if not NIL */
 static cell_t *new_frame_io(secd_t *secd, cell_t *args_io, cell_t *prevenv) {
-    cell_t *prev_io = get_car(prevenv)->as.frame.io;
+    cell_t *prev_io = frame_io(get_car(prevenv));
     if (is_nil(args_io))
         return prev_io; /* share previous i/o */
 
     if (is_nil(get_car(args_io)))
-        args_io->as.cons.car = share_cell(secd, get_car(prev_io));
+        set_car(secd, args_io, share_cell(secd, get_car(prev_io)));
     if (is_nil(get_cdr(args_io)))
-        args_io->as.cons.cdr = share_cell(secd, get_cdr(prev_io));
+        set_cdr(secd, args_io, share_cell(secd, get_cdr(prev_io)));
     return args_io; /* set a new i/o */
 }
 
@@ -226,15 +433,15 @@ cell_t *setup_frame(secd_t *secd, cell_t *argnames, cell_t *argvals, cell_t *env
     cell_t *args_io = SECD_NIL;
 
     /* setup the new frame */
-    cell_t *frame = new_frame(secd, argnames, argvals);
+    cell_t *vals = new_frame_values(secd, argnames, argvals, &args_io);
+    assert_cell(vals, "setup_frame: argument check failed");
 
-    cell_t *ret = walk_through_arguments(secd, frame, &args_io);
-    assert_cell(ret, "setup_frame: argument check failed");
+    cell_t *frame = new_frame(secd, argnames, vals);
 
     cell_t *new_io = new_frame_io(secd, args_io, env);
     assert_cell(new_io, "setup_frame: failed to set new frame I/O\n");
 
-    frame->as.frame.io = share_cell(secd, new_io);
+    set_frame_io(secd, frame, share_cell(secd, new_io));
     secd->input_port = get_car(new_io);
     secd->output_port = get_cdr(new_io);
 
@@ -242,16 +449,37 @@ cell_t *setup_frame(secd_t *secd, cell_t *argnames, cell_t *argvals, cell_t *env
 }
 
 cell_t *secd_insert_in_frame(secd_t *secd, cell_t *frame, cell_t *sym, cell_t *val) {
+    assert(!is_vector_frame(frame),
+           "secd_insert_in_frame: a vector frame can't be extended");
+
+    bool global = is_global_frame(secd, frame);
+    if (global) {
+        cell_t *entry = globals_entry(secd, symname(sym), symhash(sym));
+        if (not_nil(entry)) {
+            /* rebind in place, the binding may be cached */
+            cell_t *binding = get_cdr(entry);
+            cell_t *oldval = get_car(binding);
+            cell_t *err = set_car(secd, binding, share_cell(secd, val));
+            drop_cell(secd, oldval);
+            if (is_error(err))
+                return err;
+            return frame;
+        }
+    }
+
     cell_t *old_syms = get_car(frame);
     cell_t *old_vals = get_cdr(frame);
 
     // an interesting side effect: since there's no check for
-    // re-binding an existing symbol, we can create multiple
-    // copies of it on the frame, the last added is found
+    // re-binding an existing symbol outside of the global frame,
+    // we can create multiple copies of it on the frame, the last added is found
     // during value lookup, but the old ones are persistent
-    frame->as.cons.car = share_cell(secd, new_cons(secd, sym, old_syms));
-    frame->as.cons.cdr = share_cell(secd, new_cons(secd, val, old_vals));
+    set_car(secd, frame, share_cell(secd, new_cons(secd, sym, old_syms)));
+    set_cdr(secd, frame, share_cell(secd, new_cons(secd, val, old_vals)));
 
     drop_cell(secd, old_syms); drop_cell(secd, old_vals);
+
+    if (global)
+        globals_add(secd, sym, get_cdr(frame));
     return frame;
 }
@@ -8,6 +8,10 @@
 #define SECD_EXC_HANDLERS  "*secd-exception-handlers*"
 #define SECD_EXC_BACKTRACE "*secd-exception-backtrace*"
 
+/* secd_run_source() binds the source port, the compiler binds its function */
+#define SECD_SOURCE        "*secd-source*"
+#define SECD_COMPILE_TOP   "secd-compile-top"
+
 typedef struct {
     const char *name;
     const cell_t *val;
@@ -19,10 +23,13 @@ cell_t * make_frame_of_natives(secd_t *secd);
 
 void secd_print_env(secd_t *secd);
 void secd_init_env(secd_t *secd);
+void secd_restore_env(secd_t *secd);
 
 cell_t *setup_frame(secd_t *secd, cell_t *argnames, cell_t *argsvals, cell_t *env);
 cell_t *secd_insert_in_frame(secd_t *secd, cell_t *frame, cell_t *sym, cell_t *val);
 
 cell_t *lookup_env(secd_t *secd, const char *symbol, cell_t **symc);
+cell_t *lookup_env_cached(secd_t *secd, cell_t *sym, cell_t *cache, cell_t **symc);
+cell_t *lookup_env_index(secd_t *secd, long depth, long index);
 
 #endif //__SECD_ENV_H__
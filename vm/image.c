@@ -0,0 +1,532 @@
+#include "secd/secd.h"
+#include "secd/secd_io.h"
+
+#include "memory.h"
+#include "env.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/*
+ *      Heap images
+ *
+ *  secd_save_image() writes the heap of a machine stopped at a safe
+ *  point of the outermost run_secd() into a file, secd_load_image()
+ *  maps it back copy-on-write and secd_resume() goes on from there:
+ *  the REPL starts without reading and compiling repl.secd again.
+ *
+ *  The heap is collected and its array heap compacted before saving,
+ *  the image is:
+ *    - the header, secd_image_t, with the registers of the machine
+ *      as offsets from secd->begin;
+ *    - the persistent heap, from secd->begin;
+ *    - the array heap, from the page of secd->arrayptr to secd->end;
+ *    - the offsets of the cells which refer to the process: a native
+ *      function is kept as its index in native_functions[], a port
+ *      as its porttype makes it (see secd_pimage()).
+ *  The parts are page-aligned in the file and in the heap, so they are
+ *  mapped where they were. If the heap can't be reserved at the same
+ *  address, every pointer in it is moved; halfcons_t references are
+ *  relative, they stay valid.
+ */
+
+#define SECD_IMAGE_MAGIC    "SECDIMG"
+#define SECD_IMAGE_VERSION  1
+
+/* the options which change the layout of the heap */
+#define SECD_IMAGE_FLAGS \
+    ((COMPACTCONS) | ((IMMEDIATES) << 1) | ((ARRAYSTACK) << 2))
+
+/* the pointers of secd_t kept in the header */
+static const size_t image_regs[] = {
+    offsetof(secd_t, stack),        offsetof(secd_t, env),
+    offsetof(secd_t, control),      offsetof(secd_t, dump),
+#if (ARRAYSTACK)
+    offsetof(secd_t, stackarr),     offsetof(secd_t, dumparr),
+#endif
+    offsetof(secd_t, free),         offsetof(secd_t, halffree),
+    offsetof(secd_t, global_env),   offsetof(secd_t, globals),
+    offsetof(secd_t, symstore),     offsetof(secd_t, fixedptr),
+    offsetof(secd_t, arrayptr),     offsetof(secd_t, arrlist),
+    offsetof(secd_t, end),
+    offsetof(secd_t, input_port),   offsetof(secd_t, output_port),
+    offsetof(secd_t, error_port),   offsetof(secd_t, debug_port),
+    offsetof(secd_t, truth_value),  offsetof(secd_t, false_value),
+};
+
+#define IMAGE_NREGS  (sizeof(image_regs) / sizeof(image_regs[0]))
+
+typedef struct secd_image {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;         // SECD_IMAGE_FLAGS
+    uint32_t cellsize;      // sizeof(cell_t)
+    uint32_t pagesize;      // alignment of the parts
+    uint32_t nnatives;      // native_functions[] of the machine,
+    hash_t natives;         //   and the hash of their names
+
+    uint64_t base;          // secd->begin when saved
+    uint64_t ncells;        // secd->end - secd->begin
+    uint64_t fixed_at;      // the persistent heap in the file
+    uint64_t fixed_size;    //   bytes from secd->begin
+    uint64_t arrays_at;     // the array heap in the file
+    uint64_t arrays_from;   //   bytes from secd->begin where it starts
+    uint64_t arrays_size;
+    uint64_t fixups_at;     // offsets of the cells to fix up
+    uint64_t nfixups;
+
+    int64_t regs[IMAGE_NREGS];  // bytes from secd->begin, -1 is NIL
+    uint64_t stackptr;
+    uint64_t stackbase;
+    uint64_t dumpptr;
+    uint64_t nglobals;
+    uint64_t heapsize;
+    uint64_t tick;
+    uint64_t cycle_next;
+    secd_stat_t stat;
+} secd_image_t;
+
+/* the heap with its mark bits, as reserved by secd_init_mem() */
+static size_t image_reserved(size_t ncells) {
+    return ncells + (2 * ncells / 8) / sizeof(cell_t) + 1;
+}
+
+static hash_t natives_hash(uint32_t *count) {
+    hash_t hash = 0;
+    uint32_t i;
+    for (i = 0; native_functions[i].name; ++i)
+        hash = hash * 31 + secd_strhash(native_functions[i].name);
+    *count = i;
+    return hash;
+}
+
+static long native_index(const cell_t *func) {
+    long i;
+    for (i = 0; native_functions[i].name; ++i)
+        if (native_functions[i].val->as.ptr == func->as.ptr)
+            return i;
+    return -1;
+}
+
+static inline uint64_t page_round(uint64_t size, uint64_t pagesize) {
+    return (size + pagesize - 1) / pagesize * pagesize;
+}
+
+static bool write_at(int fd, const void *buf, size_t size, uint64_t at) {
+    const char *p = buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, at);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        p += n; at += n; size -= n;
+    }
+    return true;
+}
+
+static bool read_at(int fd, void *buf, size_t size, uint64_t at) {
+    char *p = buf;
+    while (size > 0) {
+        ssize_t n = pread(fd, p, size, at);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) continue;
+            return false;
+        }
+        p += n; at += n; size -= n;
+    }
+    return true;
+}
+
+/*
+ *      Saving
+ */
+
+/* writes the image copy of a cell which refers to the process
+ * over the cell in the parts, adds it to the fixups */
+static bool write_fixup(secd_t *secd, int fd, secd_image_t *img, cell_t *cell) {
+    cell_t copy;
+    switch (cell->type) {
+      case CELL_FUNC: {
+          long i = native_index(cell);
+          if (i < 0) {
+              errorf(";; secd_save_image: [%ld] is not a native function\n",
+                     cell_index(secd, cell));
+              return false;
+          }
+          copy = *cell;
+          copy.as.ptr = (void *)i;
+        } break;
+      case CELL_PORT:
+          secd_pimage(secd, cell, &copy);
+          break;
+      default:
+          return true;
+    }
+
+    uint64_t offset = (char *)cell - (char *)secd->begin;
+    if (offset < img->fixed_size)
+        if (!write_at(fd, &copy, sizeof(copy), img->fixed_at + offset))
+            return false;
+    if (offset >= img->arrays_from)
+        if (!write_at(fd, &copy, sizeof(copy),
+                      img->arrays_at + offset - img->arrays_from))
+            return false;
+
+    uint64_t at = img->fixups_at + sizeof(uint64_t) * img->nfixups++;
+    return write_at(fd, &offset, sizeof(offset), at);
+}
+
+/* the cells of the persistent heap and of cell arrays */
+static bool write_fixups(secd_t *secd, int fd, secd_image_t *img) {
+    cell_t *cell;
+    for (cell = secd->begin; cell < secd->fixedptr; ++cell)
+        if (!cell->half && !write_fixup(secd, fd, img, cell))
+            return false;
+
+    cell_t *upper = secd->arrlist;
+    cell_t *meta = mcons_next(upper);
+    for (; not_nil(meta); upper = meta, meta = mcons_next(meta)) {
+        if (meta->as.mcons.free || !meta->as.mcons.cells)
+            continue;
+        for (cell = meta_mem(meta); cell < upper; ++cell)
+            if (!write_fixup(secd, fd, img, cell))
+                return false;
+    }
+    return true;
+}
+
+static void save_regs(secd_t *secd, secd_image_t *img) {
+    size_t i;
+    for (i = 0; i < IMAGE_NREGS; ++i) {
+        cell_t *reg = *(cell_t **)((char *)secd + image_regs[i]);
+        img->regs[i] = (is_nil(reg) ? -1 : (char *)reg - (char *)secd->begin);
+    }
+#if (ARRAYSTACK)
+    img->stackptr = secd->stackptr;
+    img->stackbase = secd->stackbase;
+    img->dumpptr = secd->dumpptr;
+#endif
+    img->nglobals = secd->nglobals;
+    img->heapsize = secd->heapsize;
+    img->tick = secd->tick;
+    img->cycle_next = secd->cycle_next;
+    img->stat = secd->stat;
+}
+
+int secd_save_image(secd_t *secd, const char *path) {
+    if (secd->rundepth > 1) {
+        errorf(";; secd_save_image: native code may hold cells out of the heap\n");
+        return -1;
+    }
+
+    /* only the cells in use, no free array areas */
+    secd_release_dead(secd);
+    secd_mark_and_sweep_gc(secd);
+    secd_compact_arrays(secd);
+
+    secd_image_t img;
+    memset(&img, 0, sizeof(img));
+    memcpy(img.magic, SECD_IMAGE_MAGIC, sizeof(img.magic));
+    img.version = SECD_IMAGE_VERSION;
+    img.flags = SECD_IMAGE_FLAGS;
+    img.cellsize = sizeof(cell_t);
+    img.pagesize = sysconf(_SC_PAGESIZE);
+    img.natives = natives_hash(&img.nnatives);
+    img.base = (uintptr_t)secd->begin;
+    img.ncells = secd->end - secd->begin;
+
+    /* whole pages, but not out of the reservation */
+    uint64_t pagesize = img.pagesize;
+    uint64_t limit = sizeof(cell_t) * image_reserved(img.ncells);
+    uint64_t fixed_end = sizeof(cell_t) * (secd->fixedptr - secd->begin);
+    uint64_t arrays_from = sizeof(cell_t) * (secd->arrayptr - secd->begin);
+    uint64_t arrays_end = sizeof(cell_t) * img.ncells;
+
+    img.fixed_size = page_round(fixed_end, pagesize);
+    if (img.fixed_size > limit)
+        img.fixed_size = limit;
+    img.arrays_from = arrays_from / pagesize * pagesize;
+    arrays_end = page_round(arrays_end, pagesize);
+    if (arrays_end > limit)
+        arrays_end = limit;
+    img.arrays_size = arrays_end - img.arrays_from;
+
+    img.fixed_at = page_round(sizeof(img), pagesize);
+    img.arrays_at = img.fixed_at + page_round(img.fixed_size, pagesize);
+    img.fixups_at = img.arrays_at + page_round(img.arrays_size, pagesize);
+    save_regs(secd, &img);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        errorf(";; secd_save_image: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    const char *begin = (const char *)secd->begin;
+    bool ok = write_at(fd, begin, img.fixed_size, img.fixed_at)
+           && write_at(fd, begin + img.arrays_from, img.arrays_size, img.arrays_at)
+           && write_fixups(secd, fd, &img)
+           /* the header is the last: a broken image has no magic */
+           && write_at(fd, &img, sizeof(img), 0);
+    if (!ok)
+        errorf(";; secd_save_image: %s: %s\n", path, strerror(errno));
+
+    if (close(fd) && ok) {
+        errorf(";; secd_save_image: %s: %s\n", path, strerror(errno));
+        ok = false;
+    }
+    return (ok ? 0 : -1);
+}
+
+/*
+ *      Loading
+ */
+
+static bool image_fits(const secd_image_t *img, const char *path) {
+    const char *why = NULL;
+    uint32_t nnatives;
+    if (memcmp(img->magic, SECD_IMAGE_MAGIC, sizeof(img->magic)))
+        why = "not a heap image";
+    else if (img->version != SECD_IMAGE_VERSION)
+        why = "another version of the image format";
+    else if ((img->flags != SECD_IMAGE_FLAGS) || (img->cellsize != sizeof(cell_t)))
+        why = "saved by a machine of another configuration";
+    else if ((img->natives != natives_hash(&nnatives)) || (img->nnatives != nnatives))
+        why = "saved by a machine with other native functions";
+    if (why)
+        fprintf(stderr, "secd_load_image: %s: %s\n", path, why);
+    return !why;
+}
+
+/* maps a part of the image copy-on-write or reads it */
+static bool map_part(int fd, char *to, uint64_t at, uint64_t size) {
+    if (size == 0)
+        return true;
+    void *mem = mmap(to, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_FIXED, fd, at);
+    if (mem != MAP_FAILED)
+        return true;
+    return read_at(fd, to, size, at);
+}
+
+/* the heap moved from [from, limit) by delta bytes */
+typedef struct {
+    const char *from;
+    const char *limit;
+    ptrdiff_t delta;
+} heapmove_t;
+
+static inline void *moved_mem(const heapmove_t *mv, void *mem) {
+    const char *p = mem;
+    if ((p < mv->from) || (mv->limit <= p))
+        return mem;
+    return (char *)mem + mv->delta;
+}
+
+static inline cell_t *moved(const heapmove_t *mv, cell_t *cell) {
+    if (is_nil(cell) || is_immediate(cell))
+        return cell;
+    return moved_mem(mv, cell);
+}
+
+/* natives and ports are fixed up later */
+static void move_cell(const heapmove_t *mv, cell_t *cell) {
+    switch (cell->type) {
+      case CELL_CONS: case CELL_FREE:
+        cell->as.cons.car = moved(mv, cell->as.cons.car);
+        cell->as.cons.cdr = moved(mv, cell->as.cons.cdr);
+        break;
+      case CELL_FRAME:
+        cell->as.frame.cons.car = moved(mv, cell->as.frame.cons.car);
+        cell->as.frame.cons.cdr = moved(mv, cell->as.frame.cons.cdr);
+        cell->as.frame.io = moved(mv, cell->as.frame.io);
+        break;
+      case CELL_KONT:
+        cell->as.kont.stack = moved(mv, cell->as.kont.stack);
+        cell->as.kont.env = moved(mv, cell->as.kont.env);
+        cell->as.kont.ctrl = moved(mv, cell->as.kont.ctrl);
+        break;
+      case CELL_ARRMETA:
+        cell->as.mcons.prev = moved(mv, cell->as.mcons.prev);
+        cell->as.mcons.next = moved(mv, cell->as.mcons.next);
+        break;
+      case CELL_REF:
+        cell->as.ref = moved(mv, cell->as.ref);
+        break;
+      case CELL_ARRAY:
+        cell->as.arr.data = moved(mv, cell->as.arr.data);
+        break;
+      case CELL_STR: case CELL_BYTES:
+        cell->as.str.data = moved_mem(mv, cell->as.str.data);
+        break;
+      case CELL_SYM:
+        cell->as.sym.data = moved_mem(mv, (char *)cell->as.sym.data);
+        cell->as.sym.bvect = moved(mv, cell->as.sym.bvect);
+        break;
+      case CELL_ERROR:
+        cell->as.err.info = moved(mv, cell->as.err.info);
+        cell->as.err.msg = moved(mv, cell->as.err.msg);
+        cell->as.err.kont = moved(mv, cell->as.err.kont);
+        break;
+      default:
+        break;
+    }
+}
+
+/* the registers are at the new place already */
+static void move_heap(secd_t *secd, const heapmove_t *mv) {
+    cell_t *cell;
+    for (cell = secd->begin; cell < secd->fixedptr; ++cell) {
+#if (COMPACTCONS)
+        if (cell->half) {
+            /* only free halves have absolute pointers */
+            halfcons_t *pair = (halfcons_t *)cell;
+            int i;
+            for (i = 0; i < 2; ++i)
+                if (pair[i].type == CELL_FREE)
+                    pair[i].next = moved_mem(mv, pair[i].next);
+            continue;
+        }
+#endif
+        move_cell(mv, cell);
+    }
+
+    /* there are no free areas in an image */
+    cell_t *upper = SECD_NIL;
+    cell_t *meta = secd->arrlist;
+    for (; not_nil(meta); upper = meta, meta = mcons_next(meta)) {
+        move_cell(mv, meta);
+        if (is_nil(upper) || !meta->as.mcons.cells)
+            continue;
+        for (cell = meta_mem(meta); cell < upper; ++cell)
+            move_cell(mv, cell);
+    }
+}
+
+static void load_regs(secd_t *secd, const secd_image_t *img) {
+    size_t i;
+    for (i = 0; i < IMAGE_NREGS; ++i) {
+        cell_t **reg = (cell_t **)((char *)secd + image_regs[i]);
+        *reg = (img->regs[i] < 0 ? SECD_NIL
+                : (cell_t *)((char *)secd->begin + img->regs[i]));
+    }
+#if (ARRAYSTACK)
+    secd->stackptr = img->stackptr;
+    secd->stackbase = img->stackbase;
+    secd->dumpptr = img->dumpptr;
+#endif
+    secd->nglobals = img->nglobals;
+    secd->heapsize = img->heapsize;
+    secd->tick = img->tick;
+    secd->cycle_next = img->cycle_next;
+    secd->stat = img->stat;
+    secd->markbits = (uint8_t *)secd->end;
+}
+
+static bool load_fixups(secd_t *secd, int fd, const secd_image_t *img, ptrdiff_t delta) {
+    uint64_t offsets[256];
+    uint64_t done = 0;
+    while (done < img->nfixups) {
+        size_t n = sizeof(offsets) / sizeof(offsets[0]);
+        if (img->nfixups - done < n)
+            n = img->nfixups - done;
+        if (!read_at(fd, offsets, n * sizeof(uint64_t),
+                     img->fixups_at + done * sizeof(uint64_t)))
+            return false;
+
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            cell_t *cell = (cell_t *)((char *)secd->begin + offsets[i]);
+            switch (cell->type) {
+              case CELL_FUNC: {
+                  uintptr_t index = (uintptr_t)cell->as.ptr;
+                  if (index >= img->nnatives)
+                      return false;
+                  cell->as.ptr = native_functions[index].val->as.ptr;
+                } break;
+              case CELL_PORT:
+                  secd_prestore(secd, cell, delta);
+                  break;
+              default:
+                  return false;
+            }
+        }
+        done += n;
+    }
+    return true;
+}
+
+secd_t *secd_load_image(secd_t *secd, const char *path) {
+    secd_image_t img;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "secd_load_image: %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (!read_at(fd, &img, sizeof(img), 0)) {
+        fprintf(stderr, "secd_load_image: %s: not a heap image\n", path);
+        close(fd);
+        return NULL;
+    }
+    if (!image_fits(&img, path)) {
+        close(fd);
+        return NULL;
+    }
+
+    /* the same address if it's free */
+    size_t reserved = sizeof(cell_t) * image_reserved(img.ncells);
+    char *heap = mmap((void *)(uintptr_t)img.base, reserved, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (heap == MAP_FAILED) {
+        fprintf(stderr, "secd_load_image: failed to reserve a heap of %zu cells\n",
+                image_reserved(img.ncells));
+        close(fd);
+        return NULL;
+    }
+
+    if (!map_part(fd, heap, img.fixed_at, img.fixed_size)
+        || !map_part(fd, heap + img.arrays_from, img.arrays_at, img.arrays_size))
+    {
+        fprintf(stderr, "secd_load_image: %s: failed to read the heap\n", path);
+        munmap(heap, reserved);
+        close(fd);
+        return NULL;
+    }
+
+    memset(secd, 0, sizeof(secd_t));
+    secd->begin = (cell_t *)heap;
+    load_regs(secd, &img);
+    secd_init_porttypes(secd);
+
+    ptrdiff_t delta = heap - (char *)(uintptr_t)img.base;
+    if (delta) {
+        heapmove_t mv = {
+            .from = (const char *)(uintptr_t)img.base,
+            .limit = (const char *)(uintptr_t)img.base + reserved,
+            .delta = delta
+        };
+        move_heap(secd, &mv);
+    }
+
+    bool fixed = load_fixups(secd, fd, &img, delta);
+    close(fd);
+    if (!fixed) {
+        fprintf(stderr, "secd_load_image: %s: broken fixups\n", path);
+        munmap(heap, reserved);
+        return NULL;
+    }
+
+    secd_init_gc(secd);
+    secd_restore_env(secd);
+
+    /* (secd 'image) returns 'restored here */
+    if (!is_stack_empty(secd)) {
+        drop_cell(secd, pop_stack(secd));
+        push_stack(secd, new_symbol(secd, "restored"));
+    }
+    return secd;
+}
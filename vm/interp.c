@@ -13,7 +13,7 @@
 
 inline static void tail_append(secd_t *secd, cell_t **tail, cell_t *to) {
     if (is_nil(to)) return;
-    (*tail)->as.cons.cdr = share_cell(secd, to);
+    set_cdr(secd, *tail, share_cell(secd, to));
     *tail = list_next(secd, *tail);
 }
 
@@ -54,7 +54,7 @@ cell_t *compile_control_path(secd_t *secd, cell_t *control) {
         tail_append_and_move(secd, &compiled, &compcursor,
                              new_cons(secd, new_cmd, SECD_NIL));
 
-        if (new_cmd->as.op == SECD_AP) {
+        if ((new_cmd->as.op == SECD_AP) || (new_cmd->as.op == SECD_TAP)) {
             /* look ahead for possible number of arguments after AP */
             cell_t *next = list_head(cursor);
             if (is_number(next)) {
@@ -91,6 +91,15 @@ cell_t *compile_control_path(secd_t *secd, cell_t *control) {
                     tail_append(secd, &compcursor, new_cons(secd, newfunc, SECD_NIL));
                 } break;
 
+              case SECD_LDV: {
+                    cell_t *addr = list_head(cursor);
+                    assert(not_nil(addr) && is_cons(addr)
+                           && is_number(get_car(addr)) && is_number(get_cdr(addr)),
+                           "compile_ctrl: (depth . index) expected after LDV");
+                    tail_append(secd, &compcursor, new_cons(secd, addr, SECD_NIL));
+                    cursor = list_next(secd, cursor);
+                } break;
+
               case SECD_LD:
                 assert(is_symbol(list_head(cursor)),
                        "compile_ctrl: not a symbol after LD");
@@ -131,6 +140,262 @@ cell_t * compile_ctrl(secd_t *secd, cell_t **ctrl) {
     return assign_cell(secd, ctrl, compiled);
 }
 
+/* compiles the control path in the car of a cons */
+static cell_t *compile_ctrl_car(secd_t *secd, cell_t *cons) {
+    cell_t *compiled = compiled_ctrl(secd, get_car(cons));
+    if (is_nil(compiled))
+        return SECD_NIL;
+    assert_cell(compiled, "compile_ctrl: failed");
+
+    return assign_car(secd, cons, compiled);
+}
+
+/*
+ *  Code vectors: the flat form of compiled control paths
+ *
+ *  An opcode cell is followed by its operands: LD/LDC/LDF/LDV operands
+ *  are CELL_REFs to shared cells, AP/TAP may be followed by the number
+ *  of arguments, SEL and JOIN take a relative jump offset instead
+ *  of nested control paths. The vector ends with a CELL_UNDEF cell.
+ *  The LD symbol is followed by the inline cache of the site: the depth
+ *  of the global frame (-1 if empty) and a CELL_REF to the binding.
+ */
+
+#if (SUPERINSTRUCTIONS) && !(OPSTATS)
+/* the superinstruction for prevop followed by op, -1 if none;
+ * the set is tuned with (secd 'opstats), see OPSTATS in conf.h,
+ * which counts the opcodes as compiled, without fusing them */
+static int fused_opcode(int prevop, opindex_t op) {
+    switch (prevop) {
+      case SECD_CDR:
+        if (op == SECD_CAR) return SECD_CDR_CAR;
+        break;
+      case SECD_EQ:
+        if (op == SECD_SEL) return SECD_EQ_SEL;
+        break;
+      case SECD_LDC:
+        if (op == SECD_LDV) return SECD_LDC_LDV;
+        break;
+      case SECD_LDV:
+        switch (op) {
+          case SECD_CAR: return SECD_LDV_CAR;
+          case SECD_CDR: return SECD_LDV_CDR;
+          case SECD_LDV: return SECD_LDV_LDV;
+          default: break;
+        }
+        break;
+      case SECD_LEQ:
+        if (op == SECD_SEL) return SECD_LEQ_SEL;
+        break;
+    }
+    return -1;
+}
+#else
+static inline int fused_opcode(int __unused prevop, opindex_t __unused op) {
+    return -1;
+}
+#endif
+
+static void init_code_number(cell_t *cell, long num) {
+    cell->type = CELL_INT;
+    cell->nref = 1;
+    cell->as.num = num;
+}
+
+/* writes the compiled control path into the code vector at pc
+ * (or just counts cells if code is NIL); returns the next pc or -1.
+ * A SEL branch ends with JOIN, its offset position goes to *joinpc */
+static long emit_code(secd_t *secd, cell_t *code, long pc,
+                      cell_t *ctrl, long *joinpc)
+{
+    cell_t *mem = arr_mem(code);
+
+    /* the previous opcode in this straight run of code, for fusing */
+    int prevop = -1;
+    long prevpc = -1;
+
+    while (not_nil(ctrl)) {
+        cell_t *op = list_head(ctrl);
+        ctrl = list_next(secd, ctrl);
+        if (cell_type(op) != CELL_OP) {
+            errorf("emit_code: not an opcode at [%ld]\n", cell_index(secd, op));
+            return -1;
+        }
+
+        opindex_t opind = op->as.op;
+        int fused = fused_opcode(prevop, opind);
+        if (fused >= 0) {
+            /* the operands are appended after the previous ones */
+            if (mem) mem[prevpc].as.op = fused;
+            prevop = fused;
+        } else {
+            if (mem) copy_value(secd, mem + pc, op);
+            prevop = opind;
+            prevpc = pc++;
+        }
+
+        switch (opind) {
+          case SECD_SEL: {
+                long selpc = pc++;
+                long thenjoin = -1, elsejoin = -1;
+
+                pc = emit_code(secd, code, pc, list_head(ctrl), &thenjoin);
+                if (pc < 0) return -1;
+                ctrl = list_next(secd, ctrl);
+
+                long elsepc = pc;
+                pc = emit_code(secd, code, pc, list_head(ctrl), &elsejoin);
+                if (pc < 0) return -1;
+                ctrl = list_next(secd, ctrl);
+
+                /* the next opcode is a jump target */
+                prevop = -1;
+
+                if (mem) {
+                    init_code_number(mem + selpc, elsepc - (selpc + 1));
+                    if (thenjoin >= 0)
+                        init_code_number(mem + thenjoin, pc - (thenjoin + 1));
+                    if (elsejoin >= 0)
+                        init_code_number(mem + elsejoin, pc - (elsejoin + 1));
+                }
+            } break;
+
+          case SECD_JOIN:
+            if (!joinpc) {
+                errorf("emit_code: JOIN outside of SEL\n");
+                return -1;
+            }
+            /* the rest of the branch is never executed */
+            *joinpc = pc;
+            return pc + 1;
+
+          case SECD_LD:
+            if (mem) {
+                init_arr_ref(secd, mem + pc, list_head(ctrl));
+                init_code_number(mem + pc + 1, -1);
+                init_arr_ref(secd, mem + pc + 2, SECD_NIL);
+            }
+            pc += 3;
+            ctrl = list_next(secd, ctrl);
+            break;
+
+          case SECD_AP: case SECD_TAP:
+            if (not_nil(ctrl) && is_number(list_head(ctrl))) {
+                if (mem) copy_value(secd, mem + pc, list_head(ctrl));
+                ++pc;
+                ctrl = list_next(secd, ctrl);
+            }
+            break;
+
+          default: {
+                int i;
+                for (i = 0; i < opcode_table[opind].args; ++i) {
+                    if (mem) init_arr_ref(secd, mem + pc, list_head(ctrl));
+                    ++pc;
+                    ctrl = list_next(secd, ctrl);
+                }
+            }
+        }
+    }
+    return pc;
+}
+
+#if TAILRECURSION
+/* the number of cells taken by the opcode at pc with its operands */
+static long code_op_size(const cell_t *code, long pc) {
+    switch (code[pc].as.op) {
+      case SECD_LD:
+        return 4;
+      case SECD_AP: case SECD_TAP:
+        return (cell_type(code + pc + 1) == CELL_INT ? 2 : 1);
+      case SECD_SEL: case SECD_JOIN:
+        return 2;
+      default:
+        return 1 + opcode_table[code[pc].as.op].args;
+    }
+}
+
+/*
+ * checks if nothing but RTN is left to do at pc,
+ * then there's no need to save the current state on the dump.
+ */
+static bool is_tail_position(const cell_t *code, long pc) {
+    while (true) {
+        const cell_t *nextop = code + pc;
+        if (cell_type(nextop) != CELL_OP)
+            return false;
+
+        switch (nextop->as.op) {
+          case SECD_RTN:
+            return true;
+          case SECD_JOIN:
+            pc += 2 + numval(code + pc + 1);
+            break;
+          case SECD_CONS:
+            /* a situation of CONS CAR - it is how `begin` was implemented */
+            if (cell_type(code + pc + 1) != CELL_OP)
+                return false;
+            if (code[pc + 1].as.op != SECD_CAR)
+                return false;
+            pc += 2;
+            break;
+          default:
+            /* all other commands (except DUM, which must have RAP after it)
+             * mess with the stack. TCO's not possible: */
+            return false;
+        }
+    }
+}
+
+/* the compilers emit TAP for tail calls, this handles AP
+ * of other code (e.g. written by hand) once per code vector */
+static void promote_tail_calls(secd_t *secd, cell_t *code) {
+    cell_t *mem = arr_mem(code);
+    long size = arr_size(secd, code) - 1;
+
+    long pc = 0;
+    while (pc < size) {
+        long next = pc + code_op_size(mem, pc);
+        if ((mem[pc].as.op == SECD_AP) && is_tail_position(mem, next))
+            mem[pc].as.op = SECD_TAP;
+        pc = next;
+    }
+}
+#endif
+
+cell_t *compile_code_vector(secd_t *secd, cell_t *control) {
+    long size = emit_code(secd, SECD_NIL, 0, control, NULL);
+    assert(size >= 0, "compile_code_vector: invalid control path");
+
+    cell_t *code = new_array(secd, size + 1);
+    assert_cell(code, "compile_code_vector: allocation failed");
+    clear_array(secd, code, arr_size(secd, code));
+
+    emit_code(secd, code, 0, control, NULL);
+#if TAILRECURSION
+    promote_tail_calls(secd, code);
+#endif
+    return code;
+}
+
+/* a function is (args body [code]), its code vector is compiled once */
+static cell_t *func_code(secd_t *secd, cell_t *func) {
+    cell_t *bodyc = get_cdr(func);
+    cell_t *codec = get_cdr(bodyc);
+    if (not_nil(codec) && (cell_type(get_car(codec)) == CELL_ARRAY))
+        return get_car(codec);
+
+    cell_t *ret = compile_ctrl_car(secd, bodyc);
+    assert_cell(ret, "func_code: failed to compile ctrl");
+
+    cell_t *code = compile_code_vector(secd, get_car(bodyc));
+    assert_cell(code, "func_code: failed to build a code vector");
+
+    set_cdr(secd, bodyc, share_cell(secd, new_cons(secd, code, codec)));
+    drop_cell(secd, codec);
+    return code;
+}
+
 /*
  *  Run a SECD function from native code
  */
@@ -146,7 +411,8 @@ cell_t *secd_execute(secd_t *secd, cell_t *clos, cell_t *argv) {
     cell_t *env = get_cdr(clos);
 
     cell_t *args = get_car(func);
-    cell_t *ctrl = get_car(get_cdr(func));
+    cell_t *code = func_code(secd, func);
+    assert_cell(code, "secd_execute: no code");
 
     cell_t *kont = new_current_continuation(secd);
 
@@ -154,16 +420,16 @@ cell_t *secd_execute(secd_t *secd, cell_t *clos, cell_t *argv) {
     assert_cell(frame, "secd_execute: failed to setup frame");
 
     /* jump into the closure */
-    assign_cell(secd, &secd->stack, SECD_NIL);
+    new_stack_frame(secd);
     assign_cell(secd, &secd->env, new_cons(secd, frame, env));
     push_dump(secd, SECD_NIL); /* signals to run_secd() to return */
 
-    cell_t *result = run_secd(secd, ctrl);
+    cell_t *result = run_secd(secd, code);
     share_cell(secd, result);
 
-    assign_cell(secd, &secd->stack, kont->as.kont.stack);
-    assign_cell(secd, &secd->env, kont->as.kont.env);
-    assign_cell(secd, &secd->control, kont->as.kont.ctrl);
+    restore_stack_frame(secd, kont);
+    assign_cell(secd, &secd->env, saved_env(kont));
+    restore_control(secd, kont);
     //dbg_printc(secd, secd->stack);
     //dbg_printc(secd, secd->control);
 
@@ -188,20 +454,23 @@ cell_t *secd_raise(secd_t *secd, cell_t *exc) {
     }
 
     cell_t *func = get_car(handler);
+    assert(is_cons(func) && not_nil(func), "raise: exchandler is not a closure");
     cell_t *eargs = get_car(func);
-    cell_t *ectrl = get_car(get_cdr(func));
-    assert(cell_type(get_car(ectrl)) == CELL_OP, "raise: exchandler is not a closure");
+    cell_t *ecode = func_code(secd, func);
+    assert_cell(ecode, "raise: exchandler is not a closure");
 
     cell_t *eargv = new_cons(secd, exc, SECD_NIL);
 
-    cell_t *frame = setup_frame(secd, eargs, eargv, secd->env);
+    /* the handler runs in its own closure environment */
+    cell_t *eenv = get_cdr(handler);
+    cell_t *frame = setup_frame(secd, eargs, eargv, eenv);
     assert_cell(frame, "raise: setup_frame() failed");
 
     /* set new SECD state */
-    assign_cell(secd, &secd->stack, SECD_NIL);
-    assign_cell(secd, &secd->env, new_cons(secd, frame, secd->env));
-    set_control(secd, &ectrl);
-    assign_cell(secd, &secd->dump, SECD_NIL);
+    reinstate_stack(secd, SECD_NIL);
+    assign_cell(secd, &secd->env, new_cons(secd, frame, eenv));
+    set_control(secd, &ecode);
+    reinstate_dump(secd, SECD_NIL);
 
     return SECD_NIL;
 }
@@ -248,6 +517,15 @@ cell_t *secd_cons(secd_t *secd) {
     return push_stack(secd, cons);
 }
 
+cell_t *secd_pop(secd_t *secd) {
+    ctrldebugf("POP\n");
+    cell_t *top = pop_stack(secd);
+    assert_cell(top, "secd_pop: pop_stack() failed");
+
+    drop_cell(secd, top);
+    return SECD_NIL;
+}
+
 cell_t *secd_car(secd_t *secd) {
     ctrldebugf("CAR\n");
     cell_t *cons = pop_stack(secd);
@@ -277,10 +555,25 @@ cell_t *secd_ldc(secd_t *secd) {
     assert_cell(arg, "secd_ldc: pop_control failed");
 
     push_stack(secd, arg);
-    drop_cell(secd, arg);
     return arg;
 }
 
+cell_t *secd_ldv(secd_t *secd) {
+    ctrldebugf("LDV\n");
+
+    cell_t *arg = pop_control(secd);
+    assert_cell(arg, "secd_ldv: stack empty");
+
+    long depth = numval(get_car(arg));
+    long index = numval(get_cdr(arg));
+
+    cell_t *slot = lookup_env_index(secd, depth, index);
+    assert(slot, "lookup failed for (%ld . %ld)", depth, index);
+
+    push_stack(secd, slot->as.ref);
+    return SECD_NIL;
+}
+
 cell_t *secd_ld(secd_t *secd) {
     ctrldebugf("LD\n");
 
@@ -290,11 +583,13 @@ cell_t *secd_ld(secd_t *secd) {
 
     const char *sym = symname(arg);
 
+    cell_t *cache = control_peek(secd);
+    control_jump(secd, 2);
+
     cell_t *symc = SECD_NIL;
-    cell_t *val = lookup_env(secd, sym, &symc);
+    cell_t *val = lookup_env_cached(secd, arg, cache, &symc);
     assert(symc, "lookup failed for %s", sym);
 
-    drop_cell(secd, arg);
     push_stack(secd, val);
     return SECD_NIL;
 }
@@ -356,7 +651,7 @@ bool is_equal(secd_t *secd, const cell_t *a, const cell_t *b) {
       case CELL_STR:   return !strcmp(strval(a), strval(b));
       case CELL_SYM:   return a->as.sym.data == b->as.sym.data;
       case CELL_INT: case CELL_CHAR:
-                       return (a->as.num == b->as.num);
+                       return (numval(a) == numval(b));
       case CELL_OP:    return (a->as.op == b->as.op);
       case CELL_FUNC:  return (a->as.ptr == b->as.ptr);
       case CELL_BYTES: {
@@ -479,27 +774,21 @@ cell_t *secd_sel(secd_t *secd) {
     bool cond = secd_bool(secd, condcell);
     drop_cell(secd, condcell);
 
-    cell_t *thenb = pop_control(secd);
-    cell_t *elseb = pop_control(secd);
-    assert(is_cons(thenb) && is_cons(elseb), "secd_sel: both branches must be conses");
-
-    cell_t *joinb = secd->control;
-    push_dump(secd, joinb);
+    cell_t *elsejmp = pop_control(secd);
+    assert(is_number(elsejmp), "secd_sel: a jump offset expected");
 
-    secd->control = share_cell(secd, cond ? thenb : elseb);
-
-    drop_cell(secd, thenb); drop_cell(secd, elseb); drop_cell(secd, joinb);
+    if (!cond)
+        control_jump(secd, numval(elsejmp));
     return SECD_NIL;
 }
 
 cell_t *secd_join(secd_t *secd) {
     ctrldebugf("JOIN\n");
 
-    cell_t *joinb = pop_dump(secd);
-    assert_cell(joinb, "secd_join: pop_dump() failed");
-    assert(cell_type(get_car(joinb)) == CELL_OP, "secd_join: not a CELL_OP");
+    cell_t *joinjmp = pop_control(secd);
+    assert(is_number(joinjmp), "secd_join: a jump offset expected");
 
-    secd->control = joinb; //share_cell(secd, joinb); drop_cell(secd, joinb);
+    control_jump(secd, numval(joinjmp));
     return SECD_NIL;
 }
 
@@ -511,56 +800,40 @@ cell_t *secd_ldf(secd_t *secd) {
     cell_t *func = pop_control(secd);
     assert_cell(func, "secd_ldf: failed to get the control path");
 
-    cell_t *ret = compile_ctrl(secd, &func->as.cons.cdr->as.cons.car);
+    cell_t *ret = compile_ctrl_car(secd, get_cdr(func));
     assert_cell(ret, "secd_ldf: failed to compile ctrl");
 
     cell_t *closure = new_cons(secd, func, secd->env);
-    drop_cell(secd, func);
     push_stack(secd, closure);
     return SECD_NIL;
 }
 
-#if TAILRECURSION
-/*
- * returns a new dump for a tail-recursive call
- * or SECD_NIL if no Tail Call Optimization.
- */
-static cell_t * new_dump_if_tailrec(secd_t *secd, cell_t *control, cell_t *dump) {
-    if (is_nil(control))
-        return SECD_NIL;
-
-    cell_t *nextop = list_head(control);
-    if (cell_type(nextop) != CELL_OP)
-        return SECD_NIL;
-
-    opindex_t opind = nextop->as.op;
-
-    if (opind == SECD_RTN) {
-        return dump;
-    } else if (opind == SECD_JOIN) {
-        cell_t *join = list_head(dump);
-        return new_dump_if_tailrec(secd, join, list_next(secd, dump));
-    } else if (opind == SECD_CONS) {
-        /* a situation of CONS CAR - it is how `begin` implemented */
-        cell_t *nextcontrol = list_next(secd, control);
-        cell_t *afternext = list_head(nextcontrol);
-        if (cell_type(afternext) != CELL_OP)
-            return SECD_NIL;
-        if (afternext->as.op != SECD_CAR)
-            return SECD_NIL;
-        return new_dump_if_tailrec(secd, list_next(secd, nextcontrol), dump);
+static cell_t *extract_argvals(secd_t *secd) {
+    if (!is_number(control_peek(secd))) {
+        return pop_stack(secd); // don't forget to drop
     }
 
-    /* all other commands (except DUM, which must have RAP after it)
-     * mess with the stack. TCO's not possible: */
-    return SECD_NIL;
-}
-#endif
+#if (ARRAYSTACK)
+    cell_t *ntop = pop_control(secd);
+    int n = numval(ntop);
+    ctrldebugf(" %d args on stack\n", n);
+    assert(n <= (int)stack_depth(secd), "secd_ap: not enough arguments on stack");
 
-static cell_t *extract_argvals(secd_t *secd) {
-    if (!is_number(list_head(secd->control))) {
-        return pop_stack(secd); // don't forget to drop
+    /* the first argument is on the top, the last one is the list tail */
+    cell_t *argvals = SECD_NIL;
+    int i;
+    for (i = n - 1; i >= 0; --i) {
+        cell_t *item = stack_item(secd, i);
+        cell_t *val = item->as.ref;
+        argvals = new_cons(secd, val, argvals);
+        drop_cell(secd, val);
+        item->type = CELL_UNDEF;
     }
+    secd->stackptr -= n;
+
+    // has at least 1 "ref", don't forget to drop
+    return share_cell(secd, argvals);
+#else
 
     cell_t *argvals = SECD_NIL;
     cell_t *argvcursor = SECD_NIL;
@@ -576,13 +849,13 @@ static cell_t *extract_argvals(secd_t *secd) {
     }
     if (not_nil(argvcursor)) {
         argvals = secd->stack;
-        argvcursor->as.cons.cdr = SECD_NIL;
+        set_cdr(secd, argvcursor, SECD_NIL);
     }
     secd->stack = new_stack; // no share_cell
 
-    drop_cell(secd, ntop);
     // has at least 1 "ref", don't forget to drop
     return argvals;
+#endif
 }
 
 static cell_t *secd_ap_native(secd_t *secd, cell_t *clos, cell_t *argv) {
@@ -601,19 +874,18 @@ secd_ap_cont(secd_t *secd, cell_t *kont, cell_t *dump, cell_t *argv)
     assert(not_nil(argv), "secd_ap: no arguments for continuation call");
     cell_t *kontval = get_car(argv);
 
-    assign_cell(secd, &secd->stack, kont->as.kont.stack);
+    reinstate_stack(secd, saved_stack(kont));
     push_stack(secd, kontval);
 
-    assign_cell(secd, &secd->env,   kont->as.kont.env);
-    set_control(secd, &kont->as.kont.ctrl);
+    assign_cell(secd, &secd->env,   saved_env(kont));
+    restore_control(secd, kont);
 
-    assign_cell(secd, &secd->dump, dump); /* whoa, yeah */
+    reinstate_dump(secd, dump); /* whoa, yeah */
 
     return SECD_NIL;
 }
 
-cell_t *secd_ap(secd_t *secd) {
-    ctrldebugf("AP\n");
+static cell_t *secd_apply(secd_t *secd, bool tail) {
 
     cell_t *closure = pop_stack(secd);
     assert_cell(closure, "secd_ap: pop_stack(closure) failed");
@@ -643,54 +915,59 @@ cell_t *secd_ap(secd_t *secd) {
     assert(cell_type(list_head(newenv)) == CELL_FRAME,
             "secd_ap: env holds not a frame\n");
 
+    cell_t *code = func_code(secd, func);
+    assert_cell(code, "secd_ap: no code");
+
     cell_t *argnames = get_car(func);
     cell_t *frame = setup_frame(secd, argnames, argvals, newenv);
     assert_cell(frame, "secd_ap: setup_frame() failed");
 
     /* prepare dump */
-#if TAILRECURSION
-    cell_t *new_dump = new_dump_if_tailrec(secd, secd->control, secd->dump);
-    if (new_dump) {
-        assign_cell(secd, &secd->dump, new_dump);
+    if (tail) {
         ctrldebugf("secd_ap: tailrec\n");
+        clear_stack_frame(secd);
     } else {
         push_dump(secd, new_current_continuation(secd));
+        new_stack_frame(secd);
     }
-#else
-    push_dump(secd, new_current_continuation(secd));
-#endif
-    assign_cell(secd, &secd->stack, SECD_NIL);
     assign_cell(secd, &secd->env, new_cons(secd, frame, newenv));
-    set_control(secd, &func->as.cons.cdr->as.cons.car);
+    set_control(secd, &code);
 
     if (ENVDEBUG) secd_print_env(secd);
     drop_cell(secd, closure); drop_cell(secd, argvals);
     return SECD_NIL;
 }
 
+cell_t *secd_ap(secd_t *secd) {
+    ctrldebugf("AP\n");
+    return secd_apply(secd, false);
+}
+
+cell_t *secd_tap(secd_t *secd) {
+    ctrldebugf("TAP\n");
+    return secd_apply(secd, TAILRECURSION);
+}
+
 cell_t *secd_rtn(secd_t *secd) {
     ctrldebugf("RTN\n");
 
-    assert(is_nil(secd->control), "secd_rtn: commands after RTN");
-
-    assert(not_nil(secd->stack), "secd_rtn: stack is empty");
+    assert(!is_stack_empty(secd), "secd_rtn: stack is empty");
     cell_t *result = pop_stack(secd);
-    assert(is_nil(secd->stack), "secd_rtn: stack holds more than 1 value");
+    assert(is_stack_empty(secd), "secd_rtn: stack holds more than 1 value");
 
     /* new SECD state */
     cell_t *kont = pop_dump(secd);
     assert(cell_type(kont) == CELL_KONT, "secd_rtn: not a continuation on dump");
 
-    set_control(secd, &kont->as.kont.ctrl);
-    //secd->control = share_cell(secd, kont->as.kont.ctrl);
-    assign_cell(secd, &secd->env, kont->as.kont.env);
-    assign_cell(secd, &secd->stack, kont->as.kont.stack);
+    restore_control(secd, kont);
+    assign_cell(secd, &secd->env, saved_env(kont));
+    restore_stack_frame(secd, kont);
     push_stack(secd, result);
 
     /* restoring I/O */
-    cell_t *frame_io = get_car(secd->env);
-    secd->input_port = get_car(frame_io->as.frame.io);
-    secd->output_port = get_cdr(frame_io->as.frame.io);
+    cell_t *io = frame_io(get_car(secd->env));
+    secd->input_port = get_car(io);
+    secd->output_port = get_cdr(io);
 
     drop_cell(secd, result);
     drop_cell(secd, kont);
@@ -721,20 +998,23 @@ cell_t *secd_rap(secd_t *secd) {
     cell_t *func = get_car(closure);
     cell_t *argnames = get_car(func);
 
+    cell_t *code = func_code(secd, func);
+    assert_cell(code, "secd_rap: no code");
+
     /* setup environment */
     cell_t *frame = setup_frame(secd, argnames, argvals, list_next(secd, newenv));
     assert_cell(frame, "secd_rap: setup_frame() failed");
 
-    newenv->as.cons.car = share_cell(secd, frame);
+    set_car(secd, newenv, share_cell(secd, frame));
 
     /* return info */
     cell_t *retkont = new_continuation(secd,
-                        secd->stack, get_cdr(secd->env), secd->control);
+                        kont_stack(secd), get_cdr(secd->env), new_current_control(secd));
 
     /* new SECD state */
-    assign_cell(secd, &secd->stack, SECD_NIL);
+    new_stack_frame(secd);
     assign_cell(secd, &secd->env, newenv);
-    set_control(secd, &func->as.cons.cdr->as.cons.car);
+    set_control(secd, &code);
     push_dump(secd, retkont);
 
     drop_cell(secd, closure); drop_cell(secd, argvals);
@@ -757,6 +1037,9 @@ cell_t *secd_apcc(secd_t *secd) {
     assert(cell_type(list_head(newenv)) == CELL_FRAME,
            "secd_apcc: not a frame in newenv");
 
+    cell_t *code = func_code(secd, func);
+    assert_cell(code, "secd_apcc: no code");
+
     cell_t *current_cont = new_current_continuation(secd);
 
     cell_t *args = get_car(func);
@@ -764,17 +1047,20 @@ cell_t *secd_apcc(secd_t *secd) {
     assert(not_nil(args), "secd_apcc: zero args in closure");
     assert(is_nil(list_next(secd, args)),
            "secd_apcc: more than 1 argument in closure");
+    /* the continuation object gets its own S and D */
+    cell_t *kont = new_continuation(secd, capture_stack(secd),
+                                    secd->env, new_current_control(secd));
     cell_t *argv = share_cell(secd,
         new_cons(secd,
-                 new_cons(secd, current_cont, secd->dump),
+                 new_cons(secd, kont, capture_dump(secd)),
                  SECD_NIL));
     cell_t *frame = setup_frame(secd, args, argv, newenv);
     assert_cell(frame, "secd_apcc: setup_frame() failed");
 
     /* new SECD state */
-    assign_cell(secd, &secd->stack, SECD_NIL);
+    new_stack_frame(secd);
     assign_cell(secd, &secd->env, new_cons(secd, frame, newenv));
-    set_control(secd, &func->as.cons.cdr->as.cons.car);
+    set_control(secd, &code);
     push_dump(secd, current_cont);
 
     drop_cell(secd, closure); drop_cell(secd, argv);
@@ -795,7 +1081,7 @@ cell_t *secd_read(secd_t *secd) {
 cell_t *secd_print(secd_t *secd) {
     ctrldebugf("PRINT\n");
 
-    cell_t *top = get_car(secd->stack);
+    cell_t *top = stack_top(secd);
     assert_cell(top, "secd_print: no stack");
 
     sexp_print(secd, top);
@@ -803,6 +1089,47 @@ cell_t *secd_print(secd_t *secd) {
     return top;
 }
 
+/*
+ *  Superinstructions: run the fused opcodes one by one,
+ *  the threaded dispatch loop inlines them
+ */
+
+static inline cell_t *
+run_fused(secd_t *secd, secd_opfunc_t first, secd_opfunc_t second) {
+    cell_t *ret = first(secd);
+    if (is_error(ret))
+        return ret;
+    return second(secd);
+}
+
+cell_t *secd_cdr_car(secd_t *secd) {
+    return run_fused(secd, secd_cdr, secd_car);
+}
+
+cell_t *secd_eq_sel(secd_t *secd) {
+    return run_fused(secd, secd_eq, secd_sel);
+}
+
+cell_t *secd_ldc_ldv(secd_t *secd) {
+    return run_fused(secd, secd_ldc, secd_ldv);
+}
+
+cell_t *secd_ldv_car(secd_t *secd) {
+    return run_fused(secd, secd_ldv, secd_car);
+}
+
+cell_t *secd_ldv_cdr(secd_t *secd) {
+    return run_fused(secd, secd_ldv, secd_cdr);
+}
+
+cell_t *secd_ldv_ldv(secd_t *secd) {
+    return run_fused(secd, secd_ldv, secd_ldv);
+}
+
+cell_t *secd_leq_sel(secd_t *secd) {
+    return run_fused(secd, secd_leq, secd_sel);
+}
+
 const opcode_t opcode_table[] = {
     // opcodes: for information, not to be called
     // keep symbols sorted properly!
@@ -819,8 +1146,10 @@ const opcode_t opcode_table[] = {
     [SECD_LD]   = { "LD",      secd_ld,   1,  1},
     [SECD_LDC]  = { "LDC",     secd_ldc,  1,  1},
     [SECD_LDF]  = { "LDF",     secd_ldf,  1,  1},
+    [SECD_LDV]  = { "LDV",     secd_ldv,  1,  1},
     [SECD_LEQ]  = { "LEQ",     secd_leq,  0, -1},
     [SECD_MUL]  = { "MUL",     secd_mul,  0, -1},
+    [SECD_POP]  = { "POP",     secd_pop,  0, -1},
     [SECD_PRN]  = { "PRINT",   secd_print,0,  0},
     [SECD_RAP]  = { "RAP",     secd_rap,  0, -1},
     [SECD_READ] = { "READ",    secd_read, 0,  1},
@@ -829,9 +1158,19 @@ const opcode_t opcode_table[] = {
     [SECD_SEL]  = { "SEL",     secd_sel,  2, -1},
     [SECD_STOP] = { "STOP",    SECD_NIL,  0,  0},
     [SECD_SUB]  = { "SUB",     secd_sub,  0, -1},
+    [SECD_TAP]  = { "TAP",     secd_tap,  0, -1},
     [SECD_TYPE] = { "TYPE",    secd_type, 0,  0},
 
-    [SECD_LAST] = { NULL,         NULL,      0,  0}
+    [SECD_LAST] = { NULL,         NULL,      0,  0},
+
+    // superinstructions: args are operand cells in the code vector
+    [SECD_CDR_CAR] = { "CDR_CAR",  secd_cdr_car, 0,  0},
+    [SECD_EQ_SEL]  = { "EQ_SEL",   secd_eq_sel,  1, -2},
+    [SECD_LDC_LDV] = { "LDC_LDV",  secd_ldc_ldv, 2,  2},
+    [SECD_LDV_CAR] = { "LDV_CAR",  secd_ldv_car, 1,  1},
+    [SECD_LDV_CDR] = { "LDV_CDR",  secd_ldv_cdr, 1,  1},
+    [SECD_LDV_LDV] = { "LDV_LDV",  secd_ldv_ldv, 2,  2},
+    [SECD_LEQ_SEL] = { "LEQ_SEL",  secd_leq_sel, 1, -2},
 };
 
 int optable_len = 0;
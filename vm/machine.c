@@ -5,6 +5,8 @@
 #include "env.h"
 #include "secdops.h"
 
+#include <string.h>
+
 #if (TIMING)
 # include <sys/time.h>
 #endif
@@ -17,11 +19,15 @@ int secd_dump_state(secd_t *secd, cell_t *fname);
 
 secd_t * init_secd(secd_t *secd, cell_t *heap, size_t ncells) {
     secd->free = SECD_NIL;
+    secd->halffree = SECD_NIL;
+    secd->deadq = SECD_NIL;
     secd->stack = secd->dump =
         secd->control = secd->env = SECD_NIL;
 
     secd->tick = 0;
     secd->postop = SECD_NOPOST;
+    secd->rundepth = 0;
+    secd->imagepath = NULL;
 
     secd_init_mem(secd, heap, ncells);
 
@@ -35,6 +41,8 @@ secd_t * init_secd(secd_t *secd, cell_t *heap, size_t ncells) {
 }
 
 static bool handle_exception(secd_t *secd, cell_t *exc) {
+    if (secd_reserve_spent(secd))
+        return false;
     return !is_error(secd_raise(secd, exc));
 }
 
@@ -46,11 +54,21 @@ static cell_t *fatal_exception(secd_t *secd, cell_t *exc, int opind) {
     return exc;
 }
 
-static void run_postop(secd_t *secd) {
+/* returns an error if the heap has run out */
+static cell_t *run_postop(secd_t *secd) {
     cell_t *tmp;
+    if (secd->stat.n_alloc >= secd->gc_next)
+        secd_gc_policy(secd);
+
     switch (secd->postop) {
       case SECDPOST_GC:
           secd_mark_and_sweep_gc(secd);
+          if (secd->rundepth == 1)
+              secd_compact_arrays(secd);
+          break;
+      case SECDPOST_CYCLES:
+          if (secd->rundepth == 1)
+              secd_collect_cycles(secd);
           break;
       case SECDPOST_MACHINE_DUMP:
           tmp = new_string(secd, "secdstate.dump"); 
@@ -58,10 +76,21 @@ static void run_postop(secd_t *secd) {
           secd_dump_state(secd, tmp);
           drop_cell(secd, tmp);
           break;
+      case SECDPOST_IMAGE:
+          /* native code may hold cells out of the heap */
+          if (secd->rundepth == 1)
+              secd_save_image(secd, secd->imagepath);
+          else
+              errorf(";; the heap image is only saved by the outermost run_secd()\n");
+          break;
       case SECD_NOPOST:
           break;
     }
     secd->postop = SECD_NOPOST;
+
+    if (secd->outofmem)
+        return secd_check_reserve(secd);
+    return SECD_NIL;
 }
 
 static bool about_to_halt(secd_t *secd, int opind, cell_t **ret) {
@@ -71,14 +100,14 @@ static bool about_to_halt(secd_t *secd, int opind, cell_t **ret) {
           return true;
 
       case SECD_RTN:
-          if (not_nil(secd->dump) && is_nil(get_car(secd->dump))) {
+          if (!is_dump_empty(secd) && is_nil(dump_top(secd))) {
             pop_dump(secd);
             /* return into native code */
-            if (is_nil(secd->stack)) {
+            if (is_stack_empty(secd)) {
                 *ret = new_error(secd, SECD_NIL,
                                  "secd_run: No value on stack to return");
             } else {
-                *ret = list_head(secd->stack);
+                *ret = stack_top(secd);
             }
             return true;
           }
@@ -86,6 +115,89 @@ static bool about_to_halt(secd_t *secd, int opind, cell_t **ret) {
     return false;
 }
 
+#if (OPSTATS)
+/*
+ *  Opcode statistics: how many times each pair and triple
+ *  of opcodes have been executed in a row
+ */
+#define OPSTATS_TOP     20
+
+static unsigned long opstats_pairs[SECD_OPCOUNT][SECD_OPCOUNT];
+static unsigned long opstats_triples[SECD_OPCOUNT][SECD_OPCOUNT][SECD_OPCOUNT];
+static int opstats_last[2] = { -1, -1 };
+
+static inline void opstats_count(int opind) {
+    int op1 = opstats_last[0], op2 = opstats_last[1];
+    if (op2 >= 0) {
+        ++opstats_pairs[op2][opind];
+        if (op1 >= 0)
+            ++opstats_triples[op1][op2][opind];
+    }
+    opstats_last[0] = op2;
+    opstats_last[1] = opind;
+}
+
+struct opstat {
+    unsigned long count;
+    int ops[3];
+};
+
+/* keeps top[] sorted by count, descending */
+static void opstats_rank(struct opstat *top, unsigned long count,
+                         int op1, int op2, int op3)
+{
+    if (count <= top[OPSTATS_TOP - 1].count)
+        return;
+
+    int i = OPSTATS_TOP - 1;
+    while ((i > 0) && (top[i - 1].count < count)) {
+        top[i] = top[i - 1];
+        --i;
+    }
+    top[i].count = count;
+    top[i].ops[0] = op1; top[i].ops[1] = op2; top[i].ops[2] = op3;
+}
+
+static void opstats_print(secd_t *secd, const char *title,
+                          const struct opstat *top, int len)
+{
+    errorf(";; %s:\n", title);
+    int i, j;
+    for (i = 0; (i < OPSTATS_TOP) && top[i].count; ++i) {
+        errorf(";;  %10lu ", top[i].count);
+        for (j = 0; j < len; ++j)
+            errorf(" %s", opcode_table[ top[i].ops[j] ].name);
+        errorf("\n");
+    }
+}
+
+void secd_print_opstats(secd_t *secd) {
+    struct opstat top[OPSTATS_TOP];
+    int i, j, k;
+
+    memset(top, 0, sizeof(top));
+    for (i = 0; i < SECD_OPCOUNT; ++i)
+        for (j = 0; j < SECD_OPCOUNT; ++j)
+            opstats_rank(top, opstats_pairs[i][j], i, j, -1);
+    opstats_print(secd, "the most frequent opcode pairs", top, 2);
+
+    memset(top, 0, sizeof(top));
+    for (i = 0; i < SECD_OPCOUNT; ++i)
+        for (j = 0; j < SECD_OPCOUNT; ++j)
+            for (k = 0; k < SECD_OPCOUNT; ++k)
+                opstats_rank(top, opstats_triples[i][j][k], i, j, k);
+    opstats_print(secd, "the most frequent opcode triples", top, 3);
+}
+
+# define OPSTATS_COUNT(opind)  opstats_count(opind)
+#else
+void secd_print_opstats(secd_t *secd) {
+    errorf(";; opcode statistics are off, see OPSTATS in conf.h\n");
+}
+
+# define OPSTATS_COUNT(opind)
+#endif
+
 #if (TIMING)
 # define TIMING_DECLARATIONS(ts_then, ts_now) \
     struct timeval ts_then, ts_now;
@@ -105,25 +217,353 @@ static bool about_to_halt(secd_t *secd, int opind, cell_t **ret) {
 # define TIMING_END_OPERATION(ts_then, ts_now)
 #endif
 
-cell_t * run_secd(secd_t *secd, cell_t *ctrl) {
+#if (THREADEDCODE) && defined(__GNUC__) && !(TIMING) && !(CTRLDEBUG)
+/*
+ *  Threaded dispatch: every opcode body jumps to the next opcode
+ *  through a table of label addresses. The hot opcodes are inlined,
+ *  falling back to their opcode_table[] routine on anything unusual.
+ *  Postops are only checked at safepoints: after calls, returns and
+ *  non-inlined opcodes, the inlined bodies never set them.
+ */
+
+#if (ARRAYSTACK)
+/* replaces the top of the stack in place */
+static inline void replace_stack_top(secd_t *secd, cell_t *val) {
+    cell_t *top = stack_item(secd, 0);
+    cell_t *old = top->as.ref;
+    top->as.ref = share_cell(secd, val);
+    drop_cell(secd, old);
+}
+
+static inline bool has_two_on_stack(secd_t *secd) {
+    return stack_depth(secd) >= 2;
+}
+
+/* the value under the top of the stack */
+static inline cell_t *stack_next(secd_t *secd) {
+    return stack_item(secd, 1)->as.ref;
+}
+#else
+/* replaces the top of the stack, in place if the stack is not shared */
+static inline void replace_stack_top(secd_t *secd, cell_t *val) {
+    cell_t *top = secd->stack;
+    if (top->nref == 1) {
+        cell_t *old = get_car(top);
+        set_car(secd, top, share_cell(secd, val));
+        drop_cell(secd, old);
+    } else {
+        cell_t *old = pop_stack(secd);
+        push_stack(secd, val);
+        drop_cell(secd, old);
+    }
+}
+
+static inline bool has_two_on_stack(secd_t *secd) {
+    return not_nil(secd->stack) && not_nil(get_cdr(secd->stack));
+}
+
+static inline cell_t *stack_next(secd_t *secd) {
+    return get_car(get_cdr(secd->stack));
+}
+#endif
+
+#define DISPATCH_NEXT                           \
+    do {                                        \
+        ++secd->tick;                           \
+        op = control_peek(secd);                \
+        ++secd->control->as.arr.offset;         \
+        if (cell_type(op) != CELL_OP)           \
+            goto not_an_opcode;                 \
+        opind = op->as.op;                      \
+        OPSTATS_COUNT(opind);                   \
+        goto *dispatch_table[opind];            \
+    } while (0)
+
+#define CHECK_RESULT(ret)                                   \
+    if (is_error(ret))                                      \
+        if (!handle_exception(secd, ret))                   \
+            return fatal_exception(secd, ret, opind);
+
+#define SAFEPOINT                                                \
+    if (secd->postop || (secd->stat.n_alloc >= secd->gc_next)) { \
+        ret = run_postop(secd);                                  \
+        CHECK_RESULT(ret);                                       \
+    }
+
+static cell_t *run_threaded(secd_t *secd) {
+    static const void *dispatch_table[SECD_OPCOUNT] = {
+        [SECD_ADD]  = &&op_add,
+        [SECD_AP]   = &&op_ap,
+        [SECD_APCC] = &&op_generic,
+        [SECD_CAR]  = &&op_car,
+        [SECD_CDR]  = &&op_cdr,
+        [SECD_CONS] = &&op_cons,
+        [SECD_DIV]  = &&op_generic,
+        [SECD_DUM]  = &&op_generic,
+        [SECD_EQ]   = &&op_eq,
+        [SECD_JOIN] = &&op_join,
+        [SECD_LD]   = &&op_ld,
+        [SECD_LDC]  = &&op_ldc,
+        [SECD_LDF]  = &&op_generic,
+        [SECD_LDV]  = &&op_ldv,
+        [SECD_LEQ]  = &&op_generic,
+        [SECD_MUL]  = &&op_generic,
+        [SECD_POP]  = &&op_pop,
+        [SECD_PRN]  = &&op_generic,
+        [SECD_RAP]  = &&op_generic,
+        [SECD_READ] = &&op_generic,
+        [SECD_REM]  = &&op_generic,
+        [SECD_RTN]  = &&op_rtn,
+        [SECD_SEL]  = &&op_sel,
+        [SECD_STOP] = &&op_generic,
+        [SECD_SUB]  = &&op_generic,
+        [SECD_TAP]  = &&op_tap,
+        [SECD_TYPE] = &&op_generic,
+        [SECD_LAST] = &&not_an_opcode,
+
+        [SECD_CDR_CAR] = &&op_cdr_car,
+        [SECD_EQ_SEL]  = &&op_eq_sel,
+        [SECD_LDC_LDV] = &&op_ldc_ldv,
+        [SECD_LDV_CAR] = &&op_ldv_car,
+        [SECD_LDV_CDR] = &&op_ldv_cdr,
+        [SECD_LDV_LDV] = &&op_ldv_ldv,
+        [SECD_LEQ_SEL] = &&op_leq_sel,
+    };
+
+    cell_t *op, *ret, *arg, *val, *symc, *cache, *slot;
+    int opind;
+
+    DISPATCH_NEXT;
+
+op_ldc:
+    arg = pop_control(secd);
+    push_stack(secd, arg);
+    DISPATCH_NEXT;
+
+op_ld:
+    arg = pop_control(secd);
+    cache = control_peek(secd);
+    control_jump(secd, 2);
+    symc = SECD_NIL;
+    val = lookup_env_cached(secd, arg, cache, &symc);
+    if (is_nil(symc)) {
+        /* let secd_ld() handle it */
+        control_jump(secd, -3);
+        goto op_generic;
+    }
+    push_stack(secd, val);
+    DISPATCH_NEXT;
+
+op_ldv:
+    arg = pop_control(secd);
+    val = lookup_env_index(secd, numval(get_car(arg)), numval(get_cdr(arg)));
+    if (is_nil(val)) {
+        /* let secd_ldv() handle it */
+        control_jump(secd, -1);
+        goto op_generic;
+    }
+    push_stack(secd, val->as.ref);
+    DISPATCH_NEXT;
+
+op_sel:
+    val = pop_stack(secd);
+    arg = pop_control(secd);
+    if (!secd_bool(secd, val))
+        control_jump(secd, numval(arg));
+    drop_cell(secd, val);
+    DISPATCH_NEXT;
+
+op_join:
+    arg = pop_control(secd);
+    control_jump(secd, numval(arg));
+    DISPATCH_NEXT;
+
+op_car:
+    if (is_stack_empty(secd))
+        goto op_generic;
+    val = stack_top(secd);
+    if (is_nil(val) || (cell_type(val) != CELL_CONS))
+        goto op_generic;
+    replace_stack_top(secd, get_car(val));
+    DISPATCH_NEXT;
+
+op_cdr:
+    if (is_stack_empty(secd))
+        goto op_generic;
+    val = stack_top(secd);
+    if (is_nil(val) || (cell_type(val) != CELL_CONS))
+        goto op_generic;
+    replace_stack_top(secd, get_cdr(val));
+    DISPATCH_NEXT;
+
+op_cons:
+    if (!has_two_on_stack(secd))
+        goto op_generic;
+    arg = pop_stack(secd);
+    replace_stack_top(secd, new_cons(secd, arg, stack_top(secd)));
+    drop_cell(secd, arg);
+    DISPATCH_NEXT;
+
+op_add:
+    if (!has_two_on_stack(secd))
+        goto op_generic;
+    if (!is_number(stack_top(secd))
+        || !is_number(stack_next(secd)))
+        goto op_generic;
+    arg = pop_stack(secd);
+    val = stack_top(secd);
+    replace_stack_top(secd, new_number(secd, numval(arg) + numval(val)));
+    drop_cell(secd, arg);
+    DISPATCH_NEXT;
+
+op_eq:
+    /* secd_eq() does not compare errors, it raises them */
+    if (!has_two_on_stack(secd)
+        || is_error(stack_top(secd)) || is_error(stack_next(secd)))
+        goto op_generic;
+    arg = pop_stack(secd);
+    val = stack_top(secd);
+    replace_stack_top(secd, to_bool(secd, is_equal(secd, arg, val)));
+    drop_cell(secd, arg);
+    DISPATCH_NEXT;
+
+op_pop:
+    if (is_stack_empty(secd))
+        goto op_generic;
+    drop_cell(secd, pop_stack(secd));
+    DISPATCH_NEXT;
+
+    /* superinstructions: on anything unusual the operands are
+     * put back and the fused opcodes run one by one */
+op_cdr_car:
+    if (is_stack_empty(secd))
+        goto op_generic;
+    val = stack_top(secd);
+    if (is_nil(val) || (cell_type(val) != CELL_CONS))
+        goto op_generic;
+    val = get_cdr(val);
+    if (is_nil(val) || (cell_type(val) != CELL_CONS))
+        goto op_generic;
+    replace_stack_top(secd, get_car(val));
+    DISPATCH_NEXT;
+
+op_eq_sel:
+    if (!has_two_on_stack(secd)
+        || is_error(stack_top(secd)) || is_error(stack_next(secd)))
+        goto op_generic;
+    arg = pop_stack(secd);
+    val = pop_stack(secd);
+    cache = pop_control(secd);
+    if (!is_equal(secd, arg, val))
+        control_jump(secd, numval(cache));
+    drop_cell(secd, arg); drop_cell(secd, val);
+    DISPATCH_NEXT;
+
+op_leq_sel:
+    if (!has_two_on_stack(secd))
+        goto op_generic;
+    if (!is_number(stack_top(secd)) || !is_number(stack_next(secd)))
+        goto op_generic;
+    arg = pop_stack(secd);
+    val = pop_stack(secd);
+    cache = pop_control(secd);
+    if (!(numval(arg) <= numval(val)))
+        control_jump(secd, numval(cache));
+    drop_cell(secd, arg); drop_cell(secd, val);
+    DISPATCH_NEXT;
+
+op_ldc_ldv:
+    val = pop_control(secd);
+    arg = pop_control(secd);
+    slot = lookup_env_index(secd, numval(get_car(arg)), numval(get_cdr(arg)));
+    if (is_nil(slot)) {
+        control_jump(secd, -2);
+        goto op_generic;
+    }
+    push_stack(secd, val);
+    push_stack(secd, slot->as.ref);
+    DISPATCH_NEXT;
+
+op_ldv_car:
+op_ldv_cdr:
+    arg = pop_control(secd);
+    slot = lookup_env_index(secd, numval(get_car(arg)), numval(get_cdr(arg)));
+    val = (is_nil(slot) ? SECD_NIL : slot->as.ref);
+    if (is_nil(val) || (cell_type(val) != CELL_CONS)) {
+        control_jump(secd, -1);
+        goto op_generic;
+    }
+    push_stack(secd, (opind == SECD_LDV_CAR ? get_car(val) : get_cdr(val)));
+    DISPATCH_NEXT;
+
+op_ldv_ldv:
+    arg = pop_control(secd);
+    val = pop_control(secd);
+    slot = lookup_env_index(secd, numval(get_car(arg)), numval(get_cdr(arg)));
+    cache = lookup_env_index(secd, numval(get_car(val)), numval(get_cdr(val)));
+    if (is_nil(slot) || is_nil(cache)) {
+        control_jump(secd, -2);
+        goto op_generic;
+    }
+    push_stack(secd, slot->as.ref);
+    push_stack(secd, cache->as.ref);
+    DISPATCH_NEXT;
+
+op_ap:
+    ret = secd_ap(secd);
+    CHECK_RESULT(ret);
+    SAFEPOINT;
+    DISPATCH_NEXT;
+
+op_tap:
+    ret = secd_tap(secd);
+    CHECK_RESULT(ret);
+    SAFEPOINT;
+    DISPATCH_NEXT;
+
+op_rtn:
+    if (about_to_halt(secd, opind, &ret))
+        return ret;
+    ret = secd_rtn(secd);
+    CHECK_RESULT(ret);
+    SAFEPOINT;
+    DISPATCH_NEXT;
+
+op_generic:
+    if (about_to_halt(secd, opind, &ret))
+        return ret;
+    ret = ((secd_opfunc_t) opcode_table[ opind ].fun)(secd);
+    CHECK_RESULT(ret);
+    SAFEPOINT;
+    DISPATCH_NEXT;
+
+not_an_opcode:
+    /* e.g. the end of the code vector */
+    errorf("run: not an opcode at [%ld]\n", cell_index(secd, op));
+    dbg_printc(secd, op);
+    return new_error(secd, SECD_NIL, "run: not an opcode");
+}
+
+#else
+
+static cell_t *run_loop(secd_t *secd) {
     cell_t *op, *ret;
     TIMING_DECLARATIONS(ts_then, ts_now);
 
-    share_cell(secd, ctrl);
-    set_control(secd, &ctrl);
-
     while (true)  {
         TIMING_START_OPERATION(ts_then);
 
         op = pop_control(secd);
         assert_cell(op, "run: no command");
         if (cell_type(op) != CELL_OP) {
+             /* e.g. the end of the code vector */
              errorf("run: not an opcode at [%ld]\n", cell_index(secd, op));
              dbg_printc(secd, op);
-             continue;
+             return new_error(secd, SECD_NIL, "run: not an opcode");
         }
 
         int opind = op->as.op;
+        OPSTATS_COUNT(opind);
         if (about_to_halt(secd, opind, &ret))
             return ret;
 
@@ -134,15 +574,155 @@ cell_t * run_secd(secd_t *secd, cell_t *ctrl) {
             if (!handle_exception(secd, ret))
                 return fatal_exception(secd, ret, opind);
 
-        drop_cell(secd, op);
-
         TIMING_END_OPERATION(ts_then, ts_now)
 
-        run_postop(secd);
+        ret = run_postop(secd);
+        if (is_error(ret))
+            if (!handle_exception(secd, ret))
+                return fatal_exception(secd, ret, opind);
 
         ++secd->tick;
     }
 }
+#endif
+
+cell_t * run_secd(secd_t *secd, cell_t *ctrl) {
+    share_cell(secd, ctrl);
+    cell_t *ret = set_control(secd, &ctrl);
+    drop_cell(secd, ctrl);
+    assert_cell(ret, "run: no control path");
+
+    return secd_resume(secd);
+}
+
+/* runs the machine from its current state, e.g. loaded from an image */
+cell_t * secd_resume(secd_t *secd) {
+    cell_t *ret;
+    ++secd->rundepth;
+#if (THREADEDCODE) && defined(__GNUC__) && !(TIMING) && !(CTRLDEBUG)
+    ret = run_threaded(secd);
+#else
+    ret = run_loop(secd);
+#endif
+    --secd->rundepth;
+    return ret;
+}
+
+/* the next form of the source compiled by secd-compile-top,
+ * SECD_NIL at the end; the source port and the compiler are looked up
+ * for every form: the collector sees them only as global bindings */
+static cell_t *compile_next_form(secd_t *secd) {
+    cell_t *symc = SECD_NIL;
+    cell_t *port = lookup_env(secd, SECD_SOURCE, &symc);
+    assert(not_nil(symc), "secd_run_source: %s is not bound", SECD_SOURCE);
+
+    cell_t *form = sexp_parse(secd, port);
+    assert_cell(form, "secd_run_source: failed to read a form");
+    if (is_symbol(form) && str_eq(symname(form), EOF_OBJ)) {
+        free_cell(secd, form);
+        return SECD_NIL;
+    }
+
+    symc = SECD_NIL;
+    cell_t *compile = lookup_env(secd, SECD_COMPILE_TOP, &symc);
+    if (is_nil(symc)) {
+        free_cell(secd, form);
+        errorf("secd_run_source: %s is not bound by the compiler\n", SECD_COMPILE_TOP);
+        return new_error(secd, SECD_NIL, "secd_run_source: no %s", SECD_COMPILE_TOP);
+    }
+
+    /* the form and this frame are only held here: no collection
+     * while they are compiled, like in a nested run_secd() */
+    ++secd->rundepth;
+    cell_t *ctrl = secd_execute(secd, compile, new_cons(secd, form, SECD_NIL));
+    --secd->rundepth;
+    assert_cell(ctrl, "secd_run_source: failed to compile a form");
+    return ctrl;
+}
+
+/* runs a form from an empty stack and dump in the global environment;
+ * like run_secd(), but the reference to ctrl is given away: the
+ * collector doesn't see it while the form runs. The compiled control
+ * path is added to cache if it's given. */
+static cell_t *run_form(secd_t *secd, cell_t *ctrl, secdb_writer_t *cache) {
+    reinstate_stack(secd, SECD_NIL);
+    reinstate_dump(secd, SECD_NIL);
+    assign_cell(secd, &secd->env, secd->global_env);
+
+    cell_t *ret = set_control(secd, &ctrl);
+    if (cache && !is_error(ret))
+        secdb_list_add(secd, cache, ctrl);
+    drop_cell(secd, ctrl);
+    assert_cell(ret, "secd_run_source: no control path");
+
+    return secd_resume(secd);
+}
+
+/* runs a Scheme source: compiler is run first with *secd-source* bound
+ * to the source port, it binds secd-compile-top then; every form read
+ * from the port is compiled by it and run by itself. If cachepath is
+ * given and all the forms have run, their control paths are saved
+ * there for secd_run_compiled(). */
+cell_t * secd_run_source(secd_t *secd, cell_t *compiler, const char *path,
+                         const char *cachepath)
+{
+    cell_t *port = secd_fopen(secd, path, "r");
+    assert_cell(port, "secd_run_source: can't open the source");
+
+    cell_t *srcsym = new_symbol(secd, SECD_SOURCE);
+    secd_insert_in_frame(secd, list_head(secd->global_env), srcsym, port);
+
+    cell_t *ret = run_secd(secd, compiler);
+    assert_cell(ret, "secd_run_source: the compiler failed");
+
+    secdb_writer_t *cache = (cachepath ? secdb_list_new() : NULL);
+    while (true) {
+        cell_t *ctrl = compile_next_form(secd);
+        if (is_nil(ctrl)) {
+            ret = SECD_NIL;
+            break;
+        }
+        if (is_error(ctrl)) {
+            ret = ctrl;
+            break;
+        }
+
+        ret = run_form(secd, ctrl, cache);
+        if (is_error(ret))
+            break;
+    }
+
+    if (cache) {
+        if (is_error(ret))
+            secdb_list_free(cache);
+        else
+            secdb_list_write(secd, cache, cachepath);
+    }
+    return ret;
+}
+
+/* runs the control paths saved by secd_run_source(), forms is
+ * (code1 code2 ...); the forms left are bound to *secd-source* */
+cell_t * secd_run_compiled(secd_t *secd, cell_t *forms) {
+    cell_t *srcsym = new_symbol(secd, SECD_SOURCE);
+    secd_insert_in_frame(secd, list_head(secd->global_env), srcsym, forms);
+
+    while (true) {
+        cell_t *symc = SECD_NIL;
+        cell_t *rest = lookup_env(secd, SECD_SOURCE, &symc);
+        assert(not_nil(symc), "secd_run_compiled: %s is not bound", SECD_SOURCE);
+        if (is_nil(rest))
+            return SECD_NIL;
+        assert(is_cons(rest), "secd_run_compiled: a list of forms expected");
+
+        cell_t *ctrl = share_cell(secd, list_head(rest));
+        secd_insert_in_frame(secd, list_head(secd->global_env), symc, list_next(secd, rest));
+
+        cell_t *ret = run_form(secd, ctrl, NULL);
+        if (is_error(ret))
+            return ret;
+    }
+}
 
 /*
  *  Serialization
@@ -217,14 +797,14 @@ cell_t *serialize_cell(secd_t *secd, cell_t *cell) {
             opt = chain_index(secd, mcons_prev(cell), nextc);
         } break;
       case CELL_FRAME: {
-            cell_t *ioc = chain_index(secd, cell->as.frame.io, SECD_NIL);
-            cell_t *nextc = chain_index(secd, cell->as.frame.cons.cdr, ioc);
-            opt = chain_index(secd, cell->as.frame.cons.car, nextc);
+            cell_t *ioc = chain_index(secd, frame_io(cell), SECD_NIL);
+            cell_t *nextc = chain_index(secd, get_cdr(cell), ioc);
+            opt = chain_index(secd, get_car(cell), nextc);
         } break;
       case CELL_KONT: {
-            cell_t *kctrl = chain_index(secd, cell->as.kont.ctrl, SECD_NIL);
-            cell_t *kenv  = chain_index(secd, cell->as.kont.env,  kctrl);
-            opt = chain_index(secd, cell->as.kont.stack, kenv);
+            cell_t *kctrl = chain_index(secd, saved_ctrl(cell), SECD_NIL);
+            cell_t *kenv  = chain_index(secd, saved_env(cell),  kctrl);
+            opt = chain_index(secd, saved_stack(cell), kenv);
         } break;
       case CELL_FREE: {
             cell_t *nextc = chain_index(secd, get_cdr(cell), SECD_NIL);
@@ -242,7 +822,7 @@ cell_t *serialize_cell(secd_t *secd, cell_t *cell) {
     }
     opt = new_cons(secd, secd_type_sym(secd, cell), opt);
     cell_t *refc = new_cons(secd, new_number(secd, cell->nref), opt);
-    return new_cons(secd, new_number(secd, cell - secd->begin), refc);
+    return new_cons(secd, new_number(secd, cell_index(secd, cell)), refc);
 }
 
 cell_t *secd_mem_info(secd_t *secd) {
@@ -257,6 +837,8 @@ cell_t *secd_mem_info(secd_t *secd) {
 
 int secd_dump_state(secd_t *secd, cell_t *fname) {
     cell_t *p = secd_newport(secd, "w", "file", fname);
+    if (is_error(p))
+        return -1;
     secd_pprintf(secd, p,
             ";; secd->fixedptr = %ld\n", cell_index(secd, secd->fixedptr));
     secd_pprintf(secd, p,
@@ -265,11 +847,23 @@ int secd_dump_state(secd_t *secd, cell_t *fname) {
             ";; secd->end      = %ld\n", cell_index(secd, secd->end));
     secd_pprintf(secd, p, ";; secd->input_port = %ld, secd->output_port = %ld\n",
             cell_index(secd, secd->input_port), cell_index(secd, secd->output_port));
+#if (ARRAYSTACK)
+    secd_pprintf(secd, p, ";; SECD = (%ld, %ld, %ld, %ld)\n",
+            cell_index(secd, secd->stackarr), cell_index(secd, secd->env),
+            cell_index(secd, secd->control), cell_index(secd, secd->dumparr));
+    secd_pprintf(secd, p, ";; S: %zd items, frame at %zd; D: %zd items\n",
+            secd->stackptr, secd->stackbase, secd->dumpptr);
+#else
     secd_pprintf(secd, p, ";; SECD = (%ld, %ld, %ld, %ld)\n",
             cell_index(secd, secd->stack), cell_index(secd, secd->env),
             cell_index(secd, secd->control), cell_index(secd, secd->dump));
+#endif
     secd_pprintf(secd, p, ";; secd->free = %ld (%ld free)\n",
             cell_index(secd, secd->free), secd->stat.free_cells);
+#if (COMPACTCONS)
+    secd_pprintf(secd, p, ";; secd->halffree = %ld (%ld free)\n",
+            cell_index(secd, secd->halffree), secd->stat.free_halves);
+#endif
     /* dump fixed heap */
     long i;
     long n_fixed = secd->fixedptr - secd->begin;
@@ -279,6 +873,16 @@ int secd_dump_state(secd_t *secd, cell_t *fname) {
         sexp_pprint(secd, p, cell_info);
         secd_pprintf(secd, p, "\n");
         free_cell(secd, cell_info);
+#if (COMPACTCONS)
+        if (secd->begin[i].half) {
+            /* the second half of the cell */
+            cell_info = serialize_cell(secd,
+                              (cell_t *)((halfcons_t *)(secd->begin + i) + 1));
+            sexp_pprint(secd, p, cell_info);
+            secd_pprintf(secd, p, "\n");
+            free_cell(secd, cell_info);
+        }
+#endif
     }
 
     secd_pprintf(secd, p, "\n;; SECD array heap:\n");
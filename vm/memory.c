@@ -5,6 +5,11 @@
 
 #include <string.h>
 #include <stdarg.h>
+#if (PARALLELMARK)
+# include <pthread.h>
+# include <sched.h>
+# include <unistd.h>
+#endif
 
 /*
  *      A short description of SECD memory layout
@@ -16,6 +21,32 @@
 /* internal declarations */
 void free_array(secd_t *secd, cell_t *this);
 int push_free(secd_t *secd, cell_t *c);
+#if (COMPACTCONS)
+static void push_half(secd_t *secd, cell_t *c);
+static size_t reclaim_halves(secd_t *secd);
+#endif
+static bool defer_free(secd_t *secd, cell_t *c);
+static void release_dead(secd_t *secd);
+static void sweep_fixed(secd_t *secd, size_t n);
+static bool is_cycle_root(secd_t *secd, cell_t *cell);
+
+/* the mark bit of a cell or a halfcons, by its place in halves of cells */
+static inline size_t mark_index(secd_t *secd, const cell_t *cell) {
+    return ((const char *)cell - (const char *)secd->begin) / (sizeof(cell_t) / 2);
+}
+
+static inline bool is_marked(secd_t *secd, const cell_t *cell) {
+    if ((cell < secd->begin) || (secd->end <= cell))
+        return true;    /* static cells are always in use */
+    size_t i = mark_index(secd, cell);
+    return secd->markbits[i / 8] & (1 << (i % 8));
+}
+
+/* a free cell not swept yet is not in the free lists */
+static inline bool is_swept(secd_t *secd, const cell_t *cell) {
+    return is_nil(secd->sweepptr) || (cell < secd->sweepptr)
+        || is_marked(secd, cell);
+}
 
 inline static cell_t *share_array(secd_t *secd, cell_t *mem) {
     share_cell(secd, arr_meta(mem));
@@ -24,6 +55,8 @@ inline static cell_t *share_array(secd_t *secd, cell_t *mem) {
 
 inline static int drop_array(secd_t *secd, cell_t *mem) {
     cell_t *meta = arr_meta(mem);
+    if (meta->nref == NREF_MAX)
+        return 0;
     -- meta->nref;
     if (0 == meta->nref) {
         if (meta->as.mcons.cells) {
@@ -78,7 +111,7 @@ cell_t *drop_value(secd_t *secd, cell_t *c) {
     enum cell_type t = cell_type(c);
     switch (t) {
       case CELL_FRAME:
-        drop_cell(secd, c->as.frame.io);
+        drop_cell(secd, frame_io(c));
         // fall through
       case CELL_CONS:
         if (not_nil(c)) {
@@ -100,9 +133,9 @@ cell_t *drop_value(secd_t *secd, cell_t *c) {
             secd_pclose(secd, c);
         break;
       case CELL_KONT:
-        drop_cell(secd, c->as.kont.stack);
-        drop_cell(secd, c->as.kont.env);
-        drop_cell(secd, c->as.kont.ctrl);
+        drop_cell(secd, saved_stack(c));
+        drop_cell(secd, saved_env(c));
+        drop_cell(secd, saved_ctrl(c));
         break;
       case CELL_SYM:
         drop_cell(secd, c->as.sym.bvect);
@@ -118,6 +151,10 @@ cell_t *drop_value(secd_t *secd, cell_t *c) {
 }
 
 cell_t *free_cell(secd_t *secd, cell_t *c) {
+    if (is_immediate(c))
+        return SECD_NIL;
+    if (defer_free(secd, c))
+        return SECD_NIL;
     drop_value(secd, c);
     push_free(secd, c);
     return SECD_NIL;
@@ -126,6 +163,13 @@ cell_t *free_cell(secd_t *secd, cell_t *c) {
 
 cell_t *pop_free(secd_t *secd) {
     cell_t *cell;
+    int i;
+    for (i = 0; (i < DEADQ_BATCH) && not_nil(secd->deadq); ++i)
+        release_dead(secd);
+
+    while (is_nil(secd->free) && not_nil(secd->sweepptr))
+        sweep_fixed(secd, SWEEP_CHUNK);
+
     if (not_nil(secd->free)) {
         /* take a cell from the list */
         cell = secd->free;
@@ -138,8 +182,24 @@ cell_t *pop_free(secd_t *secd) {
         assert(secd->stat.free_cells == 0,
                "pop_free: free=NIL when nfree=%zd\n", secd->stat.free_cells);
         /* move fixedptr */
-        if (secd->fixedptr >= secd->arrayptr)
-            return SECD_NIL; /* Out of memory */
+        long reserve = (secd->outofmem ? 0 : HEAP_RESERVE);
+        if (secd->arrayptr - secd->fixedptr <= reserve) {
+            if (not_nil(secd->deadq)) {
+                secd_release_dead(secd);
+                return pop_free(secd);
+            }
+#if (COMPACTCONS)
+            if (reclaim_halves(secd) > 0)
+                return pop_free(secd);
+#endif
+            /* collect at the next safe point */
+            secd->gc_next = secd->stat.n_alloc;
+            if (secd->outofmem || (secd->fixedptr >= secd->arrayptr))
+                return SECD_NIL; /* Out of memory */
+
+            /* the current opcode takes the reserve */
+            secd->outofmem = true;
+        }
 
         cell = secd->fixedptr;
         ++ secd->fixedptr;
@@ -147,6 +207,8 @@ cell_t *pop_free(secd_t *secd) {
     }
 
     cell->type = CELL_UNDEF;
+    cell->half = 0;
+    cell->color = CYCLE_BLACK;
     cell->nref = 0;
     ++secd->stat.n_alloc;
     return cell;
@@ -163,6 +225,14 @@ int push_free(secd_t *secd, cell_t *c) {
         return -1;
     }
     asserti(c < secd->fixedptr, "push_free: Trying to free array cell");
+    c->color = CYCLE_BLACK;     // not a possible root anymore
+
+#if (COMPACTCONS)
+    if (c->half) {
+        push_half(secd, c);
+        return 1;
+    }
+#endif
 
     if (c + 1 < secd->fixedptr) {
         /* just add the cell to the list secd->free */
@@ -181,7 +251,7 @@ int push_free(secd_t *secd, cell_t *c) {
         memdebugf("FREE[%ld] --\n", cell_index(secd, c));
         --c;
 
-        while (c->type == CELL_FREE) {
+        while ((c->type == CELL_FREE) && !c->half && is_swept(secd, c)) {
             /* it is a cell adjacent to the free space */
             if (c != secd->free) {
                 cell_t *prev = c->as.cons.car;
@@ -210,6 +280,224 @@ int push_free(secd_t *secd, cell_t *c) {
     return 1;
 }
 
+#if (COMPACTCONS)
+/*
+ *      Halves of cells
+ *
+ *  A cell is split into two halfcons_t when a cons, a frame or
+ *  a continuation is allocated and there are no free halves. A free half
+ *  is in the list secd->halffree (linked through next). Cells with both
+ *  halves free are given back to secd->free by the garbage collector or
+ *  when pop_free() runs out of cells (see reclaim_halves()).
+ */
+
+/* encodes a reference from a halfcons, fails if it does not fit 32 bits;
+ * cells are in the heap, their offsets are multiples of halfcons_t */
+static inline bool half_encode(const halfcons_t *h, const cell_t *c, int32_t *ref) {
+    intptr_t val = (intptr_t)c;
+    if (not_nil(c) && !is_immediate(c))
+        val = (((const char *)c - (const char *)h) >> 2) | SECD_HALFREF_TAG;
+    if (val != (int32_t)val)
+        return false;
+    *ref = (int32_t)val;
+    return true;
+}
+
+static inline halfcons_t *half_sibling(secd_t *secd, cell_t *c) {
+    size_t offset = (char *)c - (char *)secd->begin;
+    halfcons_t *pair = (halfcons_t *)(secd->begin + offset / sizeof(cell_t));
+    return ((halfcons_t *)c == pair ? pair + 1 : pair);
+}
+
+static void link_free_half(secd_t *secd, halfcons_t *h) {
+    *h = (halfcons_t){ .type = CELL_FREE, .half = 1, .nref = 0,
+                       .next = (halfcons_t *)secd->halffree };
+    secd->halffree = (cell_t *)h;
+    ++secd->stat.free_halves;
+}
+
+static cell_t *pop_half(secd_t *secd) {
+    halfcons_t *h;
+    int i;
+    for (i = 0; (i < DEADQ_BATCH) && not_nil(secd->deadq); ++i)
+        release_dead(secd);
+
+    while (is_nil(secd->halffree) && is_nil(secd->free) && not_nil(secd->sweepptr))
+        sweep_fixed(secd, SWEEP_CHUNK);
+
+    if (not_nil(secd->halffree)) {
+        h = (halfcons_t *)secd->halffree;
+        secd->halffree = (cell_t *)h->next;
+        --secd->stat.free_halves;
+        ++secd->stat.n_alloc;
+    } else {
+        cell_t *cell = pop_free(secd);
+        if (is_nil(cell))
+            return SECD_NIL;
+
+        halfcons_t *pair = (halfcons_t *)cell;
+        link_free_half(secd, pair + 1);
+        h = pair;
+    }
+    return (cell_t *)h;
+}
+
+static void push_half(secd_t *secd, cell_t *c) {
+    link_free_half(secd, (halfcons_t *)c);
+}
+
+/* gives cells with both halves free back to secd->free */
+static size_t reclaim_halves(secd_t *secd) {
+    halfcons_t *h;
+
+    /* mark free halves with a free sibling */
+    for (h = (halfcons_t *)secd->halffree; h; h = h->next) {
+        halfcons_t *sibling = half_sibling(secd, (cell_t *)h);
+        if ((sibling->type == CELL_FREE) && is_swept(secd, (cell_t *)sibling))
+            h->nref = 1;
+    }
+
+    /* relink the rest, a cell is freed when both its halves are passed */
+    size_t nreclaimed = 0;
+    h = (halfcons_t *)secd->halffree;
+    secd->halffree = SECD_NIL;
+    secd->stat.free_halves = 0;
+    while (h) {
+        halfcons_t *next = h->next;
+        if (h->nref == 0) {
+            link_free_half(secd, h);
+        } else {
+            halfcons_t *sibling = half_sibling(secd, (cell_t *)h);
+            if (sibling->nref == 2) {
+                cell_t *cell = (cell_t *)(h < sibling ? h : sibling);
+                cell->half = 0;
+                cell->nref = 0;
+                push_free(secd, cell);
+                ++nreclaimed;
+            } else {
+                h->nref = 2;
+            }
+        }
+        h = next;
+    }
+    return nreclaimed;
+}
+
+/* a halfcons which is given a value that does not fit a reference refers
+ * to a full cell with it: a boxed big immediate or a copy of a static
+ * cell; heap cells always fit (HEAP_CELLS_MAX). Without a free cell
+ * the value is dropped and an error is returned */
+cell_t *set_half_ref(secd_t *secd, cell_t *cons, int32_t *ref, cell_t *val) {
+    if (half_encode((halfcons_t *)cons, val, ref))
+        return SECD_NIL;
+
+    cell_t *box = pop_free(secd);
+    if (is_nil(box)) {
+        errorf(";; set_half_ref: no cell for [%ld]\n", cell_index(secd, val));
+        drop_cell(secd, val);
+        *ref = 0;
+        return new_error(secd, SECD_NIL, "set_half_ref: out of memory");
+    }
+    copy_value(secd, box, val);
+    box->nref = 1;
+    drop_cell(secd, val);
+
+    half_encode((halfcons_t *)cons, box, ref);
+    return SECD_NIL;
+}
+#endif
+
+/*
+ *      Deferred freeing
+ *
+ *  A compound cell dropped for the last time doesn't release its cells
+ *  at once: free_cell() puts it into secd->deadq, and every allocation
+ *  releases DEADQ_BATCH cells from there (their cells may join the queue
+ *  in turn). Dropping a long list or a deep tree takes neither C stack
+ *  nor a long pause. The third reference of a waiting cell (the frame
+ *  I/O, the saved control, the error continuation) is dropped at once,
+ *  its place links the queue; a halfcons keeps the link in aux.
+ *  The garbage collector forgets the queue and sweeps its cells.
+ */
+static inline void set_dead_next(cell_t *c, cell_t *next) {
+#if (COMPACTCONS)
+    if (c->half) {
+        half_encode((halfcons_t *)c, next, &((halfcons_t *)c)->aux);
+        return;
+    }
+#endif
+    c->as.dead.next = next;
+}
+
+static inline cell_t *dead_next(const cell_t *c) {
+#if (COMPACTCONS)
+    if (c->half)
+        return half_ref((const halfcons_t *)c, ((const halfcons_t *)c)->aux);
+#endif
+    return c->as.dead.next;
+}
+
+static bool defer_free(secd_t *secd, cell_t *c) {
+    cell_t *third = SECD_NIL;
+    switch (cell_type(c)) {
+      case CELL_CONS: case CELL_REF: case CELL_ARRAY:
+        break;
+      case CELL_FRAME: third = frame_io(c); break;
+      case CELL_KONT: third = saved_ctrl(c); break;
+      case CELL_ERROR: third = c->as.err.kont; break;
+      default: return false;
+    }
+#if (COMPACTCONS)
+    int32_t ref;
+    if (c->half && !half_encode((halfcons_t *)c, secd->deadq, &ref))
+        return false;
+#endif
+
+    set_dead_next(c, secd->deadq);
+    secd->deadq = c;
+    if (++secd->stat.dead_cells > secd->stat.dead_max)
+        secd->stat.dead_max = secd->stat.dead_cells;
+
+    drop_cell(secd, third);
+    return true;
+}
+
+static void release_dead(secd_t *secd) {
+    cell_t *c = secd->deadq;
+    secd->deadq = dead_next(c);
+    --secd->stat.dead_cells;
+
+    switch (cell_type(c)) {
+      case CELL_CONS: case CELL_FRAME:
+        drop_cell(secd, get_car(c));
+        drop_cell(secd, get_cdr(c));
+        break;
+      case CELL_KONT:
+        drop_cell(secd, saved_stack(c));
+        drop_cell(secd, saved_env(c));
+        break;
+      case CELL_ERROR:
+        drop_cell(secd, c->as.err.info);
+        drop_cell(secd, c->as.err.msg);
+        break;
+      case CELL_REF:
+        drop_cell(secd, c->as.ref);
+        break;
+      case CELL_ARRAY:
+        drop_array(secd, arr_mem(c));
+        break;
+      default:
+        errorf("release_dead: unexpected cell type %d\n", cell_type(c));
+    }
+    push_free(secd, c);
+}
+
+/* releases all the dropped cells */
+void secd_release_dead(secd_t *secd) {
+    while (not_nil(secd->deadq))
+        release_dead(secd);
+}
+
 /*
  *      Array memory management
  */
@@ -227,6 +515,7 @@ static cell_t *init_meta(secd_t __unused *secd,
                          cell_t *cell, cell_t *prev, cell_t *next)
 {
     cell->type = CELL_ARRMETA;
+    cell->color = CYCLE_BLACK;
     cell->nref = 0;
     cell->as.mcons.prev = prev;
     cell->as.mcons.next = next;
@@ -234,35 +523,118 @@ static cell_t *init_meta(secd_t __unused *secd,
     return cell;
 }
 
+/* size class of a free area: log2 of its size */
+static inline int arr_bin(size_t size) {
+    int bin = 0;
+    while ((size >>= 1) && (bin < ARRAY_BINS - 1))
+        ++bin;
+    return bin;
+}
+
+/* The first cell of a free area links it into secd->arrbins[]:
+ * car/cdr are the previous/next metaconses of the size class.
+ * Areas of size 0 are not kept there, they wait to be merged. */
+static void bin_area(secd_t *secd, cell_t *meta) {
+    size_t size = arrmeta_size(secd, meta);
+    if (size == 0) return;
+
+    int bin = arr_bin(size);
+    cell_t *link = meta_mem(meta);
+    cell_t *next = secd->arrbins[bin];
+    link->type = CELL_FREE;
+    link->nref = 0;
+    link->as.cons.car = SECD_NIL;
+    link->as.cons.cdr = next;
+    if (not_nil(next))
+        meta_mem(next)->as.cons.car = meta;
+    secd->arrbins[bin] = meta;
+
+    secd->stat.arr_free += size;
+    ++secd->stat.arr_nfree;
+}
+
+/* must be done before the area changes its size */
+static void unbin_area(secd_t *secd, cell_t *meta) {
+    size_t size = arrmeta_size(secd, meta);
+    if (size == 0) return;
+
+    cell_t *link = meta_mem(meta);
+    cell_t *prev = link->as.cons.car;
+    cell_t *next = link->as.cons.cdr;
+    if (not_nil(prev))
+        meta_mem(prev)->as.cons.cdr = next;
+    else
+        secd->arrbins[arr_bin(size)] = next;
+    if (not_nil(next))
+        meta_mem(next)->as.cons.car = prev;
+    link->type = CELL_UNDEF;
+
+    secd->stat.arr_free -= size;
+    --secd->stat.arr_nfree;
+}
+
+/* a free area of at least 'size' cells or NIL:
+ * the first fit in the size class, any area of a larger class */
+static cell_t *find_free_area(secd_t *secd, size_t size) {
+    int bin = arr_bin(size);
+    cell_t *cur = secd->arrbins[bin];
+    while (not_nil(cur)) {
+        ++secd->stat.arr_probes;
+        if (arrmeta_size(secd, cur) >= size)
+            return cur;
+        cur = meta_mem(cur)->as.cons.cdr;
+    }
+
+    while (++bin < ARRAY_BINS) {
+        cur = secd->arrbins[bin];
+        if (not_nil(cur)) {
+            ++secd->stat.arr_probes;
+            return cur;
+        }
+    }
+    return SECD_NIL;
+}
+
 cell_t *alloc_array(secd_t *secd, size_t size) {
-    /* look through the list of arrays */
-    cell_t *cur = secd->arrlist;
-    while (not_nil(mcons_next(cur))) {
-        if (is_array_free(secd, cur)) {
-            size_t cursize = arrmeta_size(secd, cur);
-            if (cursize >= size) {
-                /* allocate this gap */
-                if (cursize > size + 1) {
-                    /* make a free gap after */
-                    cell_t *newmeta = cur + size + 1;
-                    cell_t *prevmeta = mcons_prev(cur);
-                    init_meta(secd, newmeta, prevmeta, cur);
-
-                    cur->as.mcons.prev = newmeta;
-                    prevmeta->as.mcons.next = newmeta;
-
-                    mark_free(newmeta, true);
-                }
-                mark_free(cur, false);
-                return meta_mem(cur);
-            }
+    ++secd->stat.arr_allocs;
+
+    cell_t *cur = (size > 0 ? find_free_area(secd, size) : SECD_NIL);
+    if (not_nil(cur)) {
+        unbin_area(secd, cur);
+
+        size_t cursize = arrmeta_size(secd, cur);
+        if (cursize > size) {
+            /* make a free gap after */
+            cell_t *newmeta = cur + size + 1;
+            cell_t *prevmeta = mcons_prev(cur);
+            init_meta(secd, newmeta, prevmeta, cur);
+
+            cur->as.mcons.prev = newmeta;
+            prevmeta->as.mcons.next = newmeta;
+
+            mark_free(newmeta, true);
+            bin_area(secd, newmeta);
         }
-        cur = mcons_next(cur);
+        mark_free(cur, false);
+        cur->as.mcons.cells = false;
+        return meta_mem(cur);
     }
 
     /* no chunks of sufficient size found, move secd->arrayptr */
-    if (secd->arrayptr - secd->fixedptr <= (int)size)
-        return SECD_NIL; /* Out of memory */
+    long reserve = (secd->outofmem ? 0 : HEAP_RESERVE);
+    if (secd->arrayptr - secd->fixedptr <= (long)size + reserve) {
+        if (not_nil(secd->deadq)) {
+            secd_release_dead(secd);
+            return alloc_array(secd, size);
+        }
+        /* collect at the next safe point */
+        secd->gc_next = secd->stat.n_alloc;
+        if (secd->outofmem || (secd->arrayptr - secd->fixedptr <= (long)size))
+            return SECD_NIL; /* Out of memory */
+
+        /* the current opcode takes the reserve */
+        secd->outofmem = true;
+    }
 
     /* create new metadata cons at arrayptr - size - 1 */
     cell_t *oldmeta = secd->arrayptr;
@@ -288,24 +660,32 @@ void free_array(secd_t *secd, cell_t *mem) {
 
     assertv(meta->nref == 0, "free_array: someone seems to still use the array");
     mark_free(meta, true);
+    meta->as.mcons.cells = false;
 
     if (meta != secd->arrayptr) {
         if (is_array_free(secd, prev)) {
             /* merge with the previous array */
+            unbin_area(secd, prev);
             cell_t *pprev = prev->as.mcons.prev;
             pprev->as.mcons.next = meta;
             meta->as.mcons.prev = pprev;
             prev->type = CELL_UNDEF;
         }
 
+        cell_t *area = meta;
+
         cell_t *next = mcons_next(meta);
         if (is_array_free(secd, next)) {
             /* merge with the next array */
+            unbin_area(secd, next);
             cell_t *newprev = meta->as.mcons.prev;
             next->as.mcons.prev = newprev;
             newprev->as.mcons.next = next;
             meta->type = CELL_UNDEF;
+            area = next;
         }
+
+        bin_area(secd, area);
     } else {
         /* move arrayptr into the array area */
         prev->as.mcons.next = SECD_NIL;
@@ -313,6 +693,7 @@ void free_array(secd_t *secd, cell_t *mem) {
 
         if (is_array_free(secd, prev)) {
             /* at most one array after 'arr' may be free */
+            unbin_area(secd, prev);
             cell_t *pprev = prev->as.mcons.prev;
             pprev->as.mcons.next = SECD_NIL;
             secd->arrayptr = pprev;
@@ -322,6 +703,21 @@ void free_array(secd_t *secd, cell_t *mem) {
     memdebugf("FREE ARR[%ld]", cell_index(secd, meta));
 }
 
+/* the largest free array area, in cells */
+size_t secd_arr_maxfree(secd_t *secd) {
+    int bin = ARRAY_BINS;
+    while (bin-- > 0) {
+        size_t maxfree = 0;
+        cell_t *cur = secd->arrbins[bin];
+        for (; not_nil(cur); cur = meta_mem(cur)->as.cons.cdr)
+            if (arrmeta_size(secd, cur) > maxfree)
+                maxfree = arrmeta_size(secd, cur);
+        if (maxfree)
+            return maxfree;
+    }
+    return 0;
+}
+
 void print_array_layout(secd_t *secd) {
     errorf(";; Array heap layout:\n");
     errorf(";;  arrayptr = %ld\n", cell_index(secd, secd->arrayptr));
@@ -334,6 +730,15 @@ void print_array_layout(secd_t *secd) {
                 cell_index(secd, mcons_prev(cur)), arrmeta_size(secd, cur),
                 (is_array_free(secd, cur)? "free" : "used"));
     }
+    errorf(";; Free areas by size class:\n");
+    int bin;
+    for (bin = 0; bin < ARRAY_BINS; ++bin) {
+        size_t n = 0;
+        for (cur = secd->arrbins[bin]; not_nil(cur); cur = meta_mem(cur)->as.cons.cdr)
+            ++n;
+        if (n)
+            errorf(";;  %zd..%zd\t%zd\n", (size_t)1 << bin, ((size_t)2 << bin) - 1, n);
+    }
 }
 
 /*
@@ -345,6 +750,7 @@ cell_t *symstore_lookup(secd_t *secd, const char *str);
 static inline cell_t*
 init_cons(secd_t *secd, cell_t *cell, cell_t *car, cell_t *cdr) {
     cell->type = CELL_CONS;
+    cell->half = 0;
     cell->as.cons.car = share_cell(secd, car);
     cell->as.cons.cdr = share_cell(secd, cdr);
     return cell;
@@ -365,18 +771,54 @@ init_symptr(secd_t __unused *secd, cell_t *cell, const char *str) {
     return cell;
 }
 
+#if (COMPACTCONS)
+/* NIL if a value does not fit a reference, the caller takes a full cell */
+static inline cell_t *
+new_half(secd_t *secd, enum cell_type t, cell_t *car, cell_t *cdr, cell_t *aux) {
+    halfcons_t *h = (halfcons_t *)pop_half(secd);
+    int32_t carref, cdrref, auxref;
+    if (!h)
+        return SECD_NIL;
+
+    if (half_encode(h, car, &carref) && half_encode(h, cdr, &cdrref)
+            && half_encode(h, aux, &auxref)) {
+        *h = (halfcons_t){ .type = t, .half = 1, .nref = 0,
+                           .aux = auxref, .car = carref, .cdr = cdrref };
+        share_cell(secd, car);
+        share_cell(secd, cdr);
+        share_cell(secd, aux);
+        return (cell_t *)h;
+    }
+    push_half(secd, (cell_t *)h);
+    return SECD_NIL;
+}
+#endif
+
 cell_t *new_cons(secd_t *secd, cell_t *car, cell_t *cdr) {
+#if (COMPACTCONS)
+    cell_t *h = new_half(secd, CELL_CONS, car, cdr, SECD_NIL);
+    if (h) return h;
+#endif
     return init_cons(secd, pop_free(secd), car, cdr);
 }
 
 cell_t *new_frame(secd_t *secd, cell_t *syms, cell_t *vals) {
-    cell_t *cons = new_cons(secd, syms, vals);
+    /* don't forget to initialize the frame io later, see set_frame_io() */
+#if (COMPACTCONS)
+    cell_t *h = new_half(secd, CELL_FRAME, syms, vals, SECD_NIL);
+    if (h) return h;
+#endif
+    cell_t *cons = init_cons(secd, pop_free(secd), syms, vals);
     cons->type = CELL_FRAME;
-    /* don't forget to initialize as.frame.io later */
+    cons->as.frame.io = SECD_NIL;
     return cons;
 }
 
 cell_t *new_continuation(secd_t *secd, cell_t *s, cell_t *e, cell_t *c) {
+#if (COMPACTCONS)
+    cell_t *h = new_half(secd, CELL_KONT, s, e, c);
+    if (h) return h;
+#endif
     cell_t *k = pop_free(secd);
     k->type = CELL_KONT;
     k->as.kont.stack = share_cell(secd, s);
@@ -385,8 +827,17 @@ cell_t *new_continuation(secd_t *secd, cell_t *s, cell_t *e, cell_t *c) {
     return k;
 }
 
+/* the machine moves its control cursor in place,
+ * so everyone else gets a copy of the current one */
+cell_t *new_current_control(secd_t *secd) {
+    if (is_nil(secd->control))
+        return SECD_NIL;
+    return new_clone(secd, secd->control);
+}
+
 cell_t *new_current_continuation(secd_t *secd) {
-    return new_continuation(secd, secd->stack, secd->env, secd->control);
+    return new_continuation(secd, kont_stack(secd), secd->env,
+                            new_current_control(secd));
 }
 
 cell_t *init_number(cell_t *c, int n) {
@@ -396,11 +847,19 @@ cell_t *init_number(cell_t *c, int n) {
 }
 
 cell_t *new_number(secd_t *secd, int num) {
+#if (IMMEDIATES)
+    if (fits_immediate(num))
+        return new_immediate(num, SECD_FIXNUM_TAG);
+#endif
     cell_t *cell = pop_free(secd);
     return init_number(cell, num);
 }
 
 cell_t *new_char(secd_t *secd, int c) {
+#if (IMMEDIATES)
+    if (fits_immediate(c))
+        return new_immediate(c, SECD_CHAR_TAG);
+#endif
     cell_t *cell = pop_free(secd);
     cell->type = CELL_CHAR;
     cell->as.num = c;
@@ -436,8 +895,10 @@ cell_t *new_array_for(secd_t *secd, cell_t *mem) {
 
 cell_t *new_array(secd_t *secd, size_t size) {
     /* try to allocate memory */
+    /* array memory is not a cell, assert_cell() can't check it */
     cell_t *mem = alloc_array(secd, size);
-    assert_cell(mem, "new_array: memory allocation failed");
+    if (is_nil(mem))
+        return new_error(secd, SECD_NIL, "new_array: memory allocation failed");
     arr_meta(mem)->as.mcons.cells = true;
 
     return new_array_for(secd, mem);
@@ -469,7 +930,8 @@ cell_t *new_strref(secd_t *secd, cell_t *mem, size_t size) {
 cell_t *new_string_of_size(secd_t *secd, size_t size) {
     cell_t *mem;
     mem = alloc_array(secd, bytes_to_cell(size));
-    assert_cell(mem, "new_string_of_size: alloc failed");
+    if (is_nil(mem))
+        return new_error(secd, SECD_NIL, "new_string_of_size: alloc failed");
 
     return new_strref(secd, mem, size);
 }
@@ -477,6 +939,7 @@ cell_t *new_string_of_size(secd_t *secd, size_t size) {
 cell_t *new_string(secd_t *secd, const char *str) {
     size_t size = strlen(str) + 1;
     cell_t *cell = new_string_of_size(secd, size);
+    assert_cell(cell, "new_string: alloc failed");
 
     strcpy(strmem(cell), str);
     return cell;
@@ -697,11 +1160,40 @@ cell_t *copy_value(secd_t *secd,
         return cell;
     }
 
+    if (is_immediate(with)) {
+        /* unpack into a heap cell, e.g. an array item */
+        cell->type = cell_type(with);
+        cell->half = 0;
+        cell->nref = (cell < secd->arrayptr ? 0 : 1);
+        cell->as.num = immval(with);
+        return cell;
+    }
+#if (COMPACTCONS)
+    if (with->half) {
+        /* unpack into a full cell */
+        if (with->type == CELL_KONT) {
+            cell->type = CELL_KONT;
+            cell->half = 0;
+            cell->as.kont.stack = share_cell(secd, saved_stack(with));
+            cell->as.kont.env   = share_cell(secd, saved_env(with));
+            cell->as.kont.ctrl  = share_cell(secd, saved_ctrl(with));
+        } else {
+            init_cons(secd, cell, get_car(with), get_cdr(with));
+            cell->type = with->type;
+            if (with->type == CELL_FRAME)
+                cell->as.frame.io = share_cell(secd, frame_io(with));
+        }
+        cell->nref = (cell < secd->arrayptr ? 0 : 1);
+        return cell;
+    }
+#endif
+
     /* copy memory */
     *cell = *with;
 
     /* a bit of a hack: assign array items nref=1 by default */
     cell->nref = (cell < secd->arrayptr ? 0 : 1);
+    cell->color = CYCLE_BLACK;
 
     switch (cell_type(with)) {
       case CELL_CONS: case CELL_FRAME:
@@ -740,14 +1232,40 @@ cell_t *copy_value(secd_t *secd,
     return cell;
 }
 
+/* a number or a character is copied into an immediate when possible */
+static cell_t *new_immediate_clone(const cell_t *from) {
+#if (IMMEDIATES)
+    switch (cell_type(from)) {
+      case CELL_INT:
+        if (fits_immediate(numval(from)))
+            return new_immediate(numval(from), SECD_FIXNUM_TAG);
+        break;
+      case CELL_CHAR:
+        if (fits_immediate(numval(from)))
+            return new_immediate(numval(from), SECD_CHAR_TAG);
+        break;
+      default: break;
+    }
+#else
+    (void)from;
+#endif
+    return SECD_NIL;
+}
+
 cell_t *new_const_clone(secd_t *secd, const cell_t *from) {
     if (is_nil(from)) return NULL;
 
+    cell_t *imm = new_immediate_clone(from);
+    if (imm) return imm;
+
     cell_t *clone = pop_free(secd);
     return copy_value(secd, clone, from);
 }
 
 cell_t *new_clone(secd_t *secd, cell_t *from) {
+    cell_t *imm = new_immediate_clone(from);
+    if (imm) return imm;
+
     cell_t *clone = pop_free(secd);
     assert_cell(clone, "new_clone: allocation failed");
 
@@ -761,7 +1279,7 @@ static cell_t *init_error(secd_t *secd, cell_t *cell, cell_t *info, const char *
     cell->type = CELL_ERROR;
     cell->as.err.msg = share_cell(secd, new_string(secd, buf));
     cell->as.err.info = share_cell(secd, info);
-    cell->as.err.kont = new_continuation(secd, secd->stack, secd->env, secd->control);
+    cell->as.err.kont = share_cell(secd, new_current_continuation(secd));
     return cell;
 }
 
@@ -837,6 +1355,162 @@ inline static cell_t *list_pop(secd_t *secd, cell_t **from) {
     return val; // don't forget to drop_cell()
 }
 
+#if (ARRAYSTACK)
+/*
+ *  S and D as arrays
+ *
+ *  secd->stackarr and secd->dumparr are arrays of CELL_REFs growing
+ *  on demand, unused items are CELL_UNDEF. A non-tail call keeps
+ *  the values of the caller on S and starts a new frame after
+ *  a marker, a CELL_INT item holding the base of the previous frame.
+ *  A first-class continuation gets copies of both arrays.
+ */
+static const size_t ARRAYSTACK_INIT_SIZE = 256;
+
+static cell_t *new_array_stack(secd_t *secd, size_t size) {
+    cell_t *arr = new_array(secd, size);
+    assert_cell(arr, "new_array_stack: failed to allocate");
+    clear_array(secd, arr, size);
+    return share_cell(secd, arr);
+}
+
+static cell_t *grow_array_stack(secd_t *secd, cell_t **arrp) {
+    cell_t *oldarr = *arrp;
+    size_t size = arr_size(secd, oldarr);
+
+    cell_t *newarr = new_array_stack(secd, 2 * size);
+    assert_cell(newarr, "grow_array_stack: failed to grow");
+
+    /* move the items */
+    memcpy(arr_ref(newarr, 0), arr_ref(oldarr, 0), size * sizeof(cell_t));
+    clear_array(secd, oldarr, size);
+
+    *arrp = newarr;
+    drop_cell(secd, oldarr);
+    return newarr;
+}
+
+static inline cell_t *stack_push_item(secd_t *secd) {
+    if (secd->stackptr == arr_size(secd, secd->stackarr)) {
+        cell_t *arr = grow_array_stack(secd, &secd->stackarr);
+        assert_cell(arr, "push_stack: no memory for S");
+    }
+    return arr_ref(secd->stackarr, secd->stackptr++);
+}
+
+cell_t *push_stack(secd_t *secd, cell_t *newc) {
+    cell_t *item = stack_push_item(secd);
+    assert_cell(item, "push_stack: failed");
+    return init_arr_ref(secd, item, newc);
+}
+
+cell_t *pop_stack(secd_t *secd) {
+    assert(secd->stackptr > secd->stackbase, "pop: stack is empty");
+
+    cell_t *item = arr_ref(secd->stackarr, --secd->stackptr);
+    item->type = CELL_UNDEF;
+    return item->as.ref; // don't forget to drop_cell()
+}
+
+cell_t *new_stack_frame(secd_t *secd) {
+    cell_t *marker = stack_push_item(secd);
+    assert_cell(marker, "new_stack_frame: failed");
+
+    marker->type = CELL_INT;
+    marker->nref = 1;
+    marker->as.num = secd->stackbase;
+
+    secd->stackbase = secd->stackptr;
+    return marker;
+}
+
+void clear_stack_frame(secd_t *secd) {
+    while (secd->stackptr > secd->stackbase)
+        drop_cell(secd, pop_stack(secd));
+}
+
+void restore_stack_frame(secd_t *secd, cell_t __unused *kont) {
+    clear_stack_frame(secd);
+
+    /* no marker after reinstate_stack(secd, SECD_NIL) */
+    if (secd->stackbase == 0)
+        return;
+
+    cell_t *marker = arr_ref(secd->stackarr, --secd->stackptr);
+    secd->stackbase = marker->as.num;
+    marker->type = CELL_UNDEF;
+}
+
+/* copies the used items of the array stack; the last item
+ * of the copy is the base of the current frame */
+static cell_t *copy_array_stack(secd_t *secd, cell_t *arr, size_t len, size_t base) {
+    cell_t *copy = new_array(secd, len + 1);
+    assert_cell(copy, "copy_array_stack: failed to allocate");
+
+    size_t i;
+    for (i = 0; i < len; ++i)
+        copy_value(secd, arr_ref(copy, i), arr_ref(arr, i));
+
+    cell_t *baseitem = arr_ref(copy, len);
+    baseitem->type = CELL_INT;
+    baseitem->nref = 1;
+    baseitem->as.num = base;
+    return copy;
+}
+
+static void reinstate_array_stack(secd_t *secd, cell_t **arrp, size_t *ptr,
+                                  const cell_t *captured)
+{
+    cell_t *arr = *arrp;
+    while (*ptr > 0) {
+        cell_t *item = arr_ref(arr, --*ptr);
+        drop_value(secd, item);
+        item->type = CELL_UNDEF;
+    }
+    if (is_nil(captured))
+        return;
+
+    size_t len = arr_size(secd, captured) - 1;
+    while (arr_size(secd, *arrp) < len) {
+        cell_t *newarr = grow_array_stack(secd, arrp);
+        assertv(!is_error(newarr), "reinstate_array_stack: no memory");
+    }
+
+    size_t i;
+    for (i = 0; i < len; ++i)
+        copy_value(secd, arr_ref(*arrp, i), arr_val(captured, i));
+    *ptr = len;
+}
+
+cell_t *capture_stack(secd_t *secd) {
+    return copy_array_stack(secd, secd->stackarr,
+                            secd->stackptr, secd->stackbase);
+}
+
+void reinstate_stack(secd_t *secd, cell_t *captured) {
+    reinstate_array_stack(secd, &secd->stackarr, &secd->stackptr, captured);
+    secd->stackbase = (is_nil(captured) ? 0 :
+            numval(arr_val(captured, arr_size(secd, captured) - 1)));
+}
+
+cell_t *capture_dump(secd_t *secd) {
+    return copy_array_stack(secd, secd->dumparr, secd->dumpptr, 0);
+}
+
+void reinstate_dump(secd_t *secd, cell_t *captured) {
+    reinstate_array_stack(secd, &secd->dumparr, &secd->dumpptr, captured);
+    secd->stat.used_dump = secd->dumpptr;
+}
+
+static void init_array_stacks(secd_t *secd) {
+    secd->stackarr = new_array_stack(secd, ARRAYSTACK_INIT_SIZE);
+    secd->stackptr = secd->stackbase = 0;
+    secd->dumparr = new_array_stack(secd, ARRAYSTACK_INIT_SIZE);
+    secd->dumpptr = 0;
+}
+
+#else
+
 cell_t *push_stack(secd_t *secd, cell_t *newc) {
     return list_push(secd, &secd->stack, newc);
 }
@@ -845,20 +1519,114 @@ cell_t *pop_stack(secd_t *secd) {
     return list_pop(secd, &secd->stack);
 }
 
+/* the caller's stack is kept in its continuation */
+cell_t *new_stack_frame(secd_t *secd) {
+    return assign_cell(secd, &secd->stack, SECD_NIL);
+}
+
+void clear_stack_frame(secd_t *secd) {
+    assign_cell(secd, &secd->stack, SECD_NIL);
+}
+
+void restore_stack_frame(secd_t *secd, cell_t *kont) {
+    assign_cell(secd, &secd->stack, saved_stack(kont));
+}
+
+/* the lists are persistent, no need to copy */
+cell_t *capture_stack(secd_t *secd) {
+    return secd->stack;
+}
+
+void reinstate_stack(secd_t *secd, cell_t *captured) {
+    assign_cell(secd, &secd->stack, captured);
+}
+
+cell_t *capture_dump(secd_t *secd) {
+    return secd->dump;
+}
+
+void reinstate_dump(secd_t *secd, cell_t *captured) {
+    assign_cell(secd, &secd->dump, captured);
+}
+
+#endif
+
 cell_t *set_control(secd_t *secd, cell_t **opcons) {
-    assert(is_cons(*opcons),
-           "set_control: failed, not a cons at [%ld]\n", cell_index(secd, *opcons));
-    compile_ctrl(secd, opcons);
-    assert_cell(*opcons, "set_control: failed to compile control path");
-    assert(cell_type(*opcons) == CELL_CONS, "set_control: not a cons");
-    assert(cell_type(get_car(*opcons)) == CELL_OP, "set_control: not an ATOM_OP");
-    return assign_cell(secd, &secd->control, *opcons);
+    cell_t *code = *opcons;
+    if (is_nil(code))
+        return assign_cell(secd, &secd->control, SECD_NIL);
+
+    if (cell_type(code) != CELL_ARRAY) {
+        /* a control path list: compile it into a code vector */
+        assert(is_cons(code),
+               "set_control: failed, not a cons at [%ld]\n", cell_index(secd, code));
+        compile_ctrl(secd, opcons);
+        assert_cell(*opcons, "set_control: failed to compile control path");
+        assert(cell_type(*opcons) == CELL_CONS, "set_control: not a cons");
+        assert(cell_type(get_car(*opcons)) == CELL_OP, "set_control: not an ATOM_OP");
+
+        code = compile_code_vector(secd, *opcons);
+        assert_cell(code, "set_control: failed to build a code vector");
+    }
+    share_cell(secd, code);
+
+    cell_t *cursor = secd->control;
+    if ((cell_type(cursor) == CELL_ARRAY) && (cursor->nref == 1)) {
+        /* the cursor is not shared, just move it */
+        if (cursor->as.arr.data != code->as.arr.data) {
+            share_array(secd, code->as.arr.data);
+            drop_array(secd, cursor->as.arr.data);
+            cursor->as.arr.data = code->as.arr.data;
+        }
+        cursor->as.arr.offset = code->as.arr.offset;
+    } else {
+        assign_cell(secd, &secd->control, new_clone(secd, code));
+    }
+
+    drop_cell(secd, code);
+    return secd->control;
+}
+
+/* continues with the control path saved in a continuation */
+cell_t *restore_control(secd_t *secd, cell_t *kont) {
+    cell_t *ctrl = share_cell(secd, saved_ctrl(kont));
+    cell_t *ret = set_control(secd, &ctrl);
+    drop_cell(secd, ctrl);
+    return ret;
 }
 
+/* returns the next cell of the code vector, owned by the code vector:
+ * an operand is a CELL_REF to a shared cell or an immediate value */
 cell_t *pop_control(secd_t *secd) {
-    return list_pop(secd, &secd->control);
+    assert(not_nil(secd->control), "pop_control: no control path");
+
+    cell_t *c = control_peek(secd);
+    ++secd->control->as.arr.offset;
+
+    if (cell_type(c) == CELL_REF)
+        return c->as.ref;
+    return c;
+}
+
+#if (ARRAYSTACK)
+cell_t *push_dump(secd_t *secd, cell_t *cell) {
+    if (secd->dumpptr == arr_size(secd, secd->dumparr)) {
+        cell_t *arr = grow_array_stack(secd, &secd->dumparr);
+        assert_cell(arr, "push_dump: no memory for D");
+    }
+    ++secd->stat.used_dump;
+    return init_arr_ref(secd, arr_ref(secd->dumparr, secd->dumpptr++), cell);
 }
 
+cell_t *pop_dump(secd_t *secd) {
+    assert(secd->dumpptr > 0, "pop: stack is empty");
+    --secd->stat.used_dump;
+
+    cell_t *item = arr_ref(secd->dumparr, --secd->dumpptr);
+    item->type = CELL_UNDEF;
+    return item->as.ref; // don't forget to drop_cell()
+}
+#else
 cell_t *push_dump(secd_t *secd, cell_t *cell) {
     ++secd->stat.used_dump;
     return list_push(secd, &secd->dump, cell);
@@ -868,6 +1636,7 @@ cell_t *pop_dump(secd_t *secd) {
     --secd->stat.used_dump;
     return list_pop(secd, &secd->dump);
 }
+#endif
 
 /*
  *     List/vector/string utilities
@@ -925,7 +1694,7 @@ cell_t *vector_to_list(secd_t *secd, cell_t *vct, int start, int end) {
     for (i = start; i < end; ++i) {
         cell_t *clone = new_clone(secd, arr_ref(vct, i));
         if (not_nil(lst)) {
-            cur->as.cons.cdr = share_cell(secd, new_cons(secd, clone, SECD_NIL));
+            set_cdr(secd, cur, share_cell(secd, new_cons(secd, clone, SECD_NIL)));
             cur = list_next(secd, cur);
         } else {
             lst = cur = new_cons(secd, clone, SECD_NIL);
@@ -1044,11 +1813,11 @@ secdht_put(secd_t *secd, cell_t *ht, cell_t *hasharr,
         cell_t *oldkv = SECD_NIL;
         if (secdht_lookup_bucket(secd, ht, bucket, key, &oldkv)) {
             /* key already exists, modify value */
-            assign_cell(secd, &oldkv->as.cons.cdr, val);
+            assign_cdr(secd, oldkv, val);
         } else {
             /* insert new kv after first item of the bucket */
-            cell_t *chainc = new_cons(secd, kv, bucket->as.cons.cdr);
-            assign_cell(secd, &bucket->as.cons.cdr, chainc);
+            cell_t *chainc = new_cons(secd, kv, get_cdr(bucket));
+            assign_cdr(secd, bucket, chainc);
             ++ arr_ref(ht, HT_SIZE)->as.num;
         }
     } else {
@@ -1231,15 +2000,15 @@ void secd_owned_cell_for(secd_t *secd, cell_t *cell,
     *ref1 = *ref2 = *ref3 = SECD_NIL;
     switch (cell_type(cell)) {
       case CELL_FRAME:
-          *ref3 = cell->as.frame.io;
+          *ref3 = frame_io(cell);
           /* FALLTHRU */
       case CELL_CONS:
           *ref1 = get_car(cell); *ref2 = get_cdr(cell);
           break;
       case CELL_KONT:
-          *ref1 = cell->as.kont.stack;
-          *ref2 = cell->as.kont.env;
-          *ref3 = cell->as.kont.ctrl;
+          *ref1 = saved_stack(cell);
+          *ref2 = saved_env(cell);
+          *ref3 = saved_ctrl(cell);
           break;
       case CELL_STR: case CELL_BYTES:
           *ref1 = arr_meta((cell_t*)strmem(cell));
@@ -1256,7 +2025,11 @@ void secd_owned_cell_for(secd_t *secd, cell_t *cell,
       case CELL_SYM:
           *ref1 = cell->as.sym.bvect;
           break;
-      case CELL_ERROR: /* TODO */
+      case CELL_ERROR:
+          *ref1 = cell->as.err.info;
+          *ref2 = cell->as.err.msg;
+          *ref3 = cell->as.err.kont;
+          break;
       /* getting owned cells is legal, no cells */
       case CELL_INT: case CELL_CHAR: case CELL_OP:
       case CELL_FUNC: case CELL_UNDEF:
@@ -1280,101 +2053,984 @@ cell_t *secd_referers_for(secd_t *secd, cell_t *cell) {
         if (ref1 == cell) result = prepend_index(secd, ith, result);
         if (ref2 == cell) result = prepend_index(secd, ith, result);
         if (ref3 == cell) result = prepend_index(secd, ith, result);
+#if (COMPACTCONS)
+        if (ith->half) {
+            cell_t *second = (cell_t *)((halfcons_t *)ith + 1);
+            secd_owned_cell_for(secd, second, &ref1, &ref2, &ref3);
+            if (ref1 == cell) result = prepend_index(secd, ith, result);
+            if (ref2 == cell) result = prepend_index(secd, ith, result);
+        }
+#endif
     }
     return result;
 }
 
-static void increment_nref_for_owned(secd_t *secd, cell_t *cell) {
-    if (is_nil(cell)) return;
+/*
+ *  Marking sets the bits of the cells reachable from a root in
+ *  secd->markbits, refcounts are left as they are.
+ *  Cells to visit wait on a mark stack in the free space between
+ *  secd->fixedptr and secd->arrayptr, so marking takes no C stack
+ *  and no memory of its own. The items of an array take two slots:
+ *  the end and the next item, tagged with MARK_ITEMS. When the free
+ *  space is full, marking recurses.
+ */
+#define MARK_ITEMS  1
 
-    ++cell->nref;
-    if (cell->nref > 1) return; /* already visited */
+/* marks a cell, false if it's marked already; a whole cell takes
+ * the bits of both halves, it may be split before it's swept */
+static inline bool mark_once(secd_t *secd, cell_t *cell) {
+    if ((cell < secd->begin) || (secd->end <= cell))
+        return false;
+    size_t i = mark_index(secd, cell);
+    uint8_t bit = 1 << (i % 8);
+    if (secd->markbits[i / 8] & bit)
+        return false;
+    if (!cell->half)
+        bit |= bit << 1;
+    secd->markbits[i / 8] |= bit;
+    if (cell < secd->fixedptr)
+        secd->stat.unswept -= (cell->half ? 1 : 2);
+    return true;
+}
 
-    if (cell_type(cell) == CELL_ARRMETA) {
-        cell_t *meta = cell;
-        if (meta->as.mcons.cells) {
-            size_t i;
-            size_t len = arrmeta_size(secd, meta);
-            for (i = 0; i < len; ++i)
-                increment_nref_for_owned(secd, meta_mem(meta) + i);
+#if defined(__GNUC__)
+# define mark_prefetch(cell)  __builtin_prefetch(cell, 1)
+#else
+# define mark_prefetch(cell)
+#endif
+
+static void mark_cells(secd_t *secd, cell_t *cell, cell_t **base, cell_t **limit);
+
+static inline cell_t **
+mark_push(secd_t *secd, cell_t *cell, cell_t **top, cell_t **limit) {
+    if (is_nil(cell) || is_immediate(cell))
+        return top;
+    if (top == limit) {
+        mark_cells(secd, cell, top, limit);
+        return top;
+    }
+    mark_prefetch(cell);
+    *top++ = cell;
+    return top;
+}
+
+static inline cell_t **
+mark_items(secd_t *secd, cell_t *meta, cell_t **top, cell_t **limit) {
+    cell_t *item = meta_mem(meta);
+    cell_t *end = mcons_prev(meta);
+    if (item == end)
+        return top;
+    if (limit - top < 2) {
+        for (; item < end; ++item)
+            mark_cells(secd, item, top, limit);
+        return top;
+    }
+    *top++ = end;
+    *top++ = (cell_t *)((uintptr_t)item | MARK_ITEMS);
+    return top;
+}
+
+static void mark_cells(secd_t *secd, cell_t *cell, cell_t **base, cell_t **limit) {
+    cell_t **top = base;
+    while (true) {
+        /* the last owned cell is visited without the stack */
+        while (mark_once(secd, cell)) {
+            if (cell_type(cell) == CELL_ARRMETA) {
+                if (cell->as.mcons.cells)
+                    top = mark_items(secd, cell, top, limit);
+                break;
+            }
+
+            cell_t *ref1, *ref2, *ref3;
+            secd_owned_cell_for(secd, cell, &ref1, &ref2, &ref3);
+            if (is_nil(ref3) || is_immediate(ref3)) {
+                ref3 = ref2; ref2 = SECD_NIL;
+            }
+            if (is_nil(ref3) || is_immediate(ref3)) {
+                ref3 = ref1; ref1 = SECD_NIL;
+            }
+            if (is_nil(ref3) || is_immediate(ref3))
+                break;
+
+            top = mark_push(secd, ref1, top, limit);
+            top = mark_push(secd, ref2, top, limit);
+            cell = ref3;
+        }
+
+        if (top == base)
+            return;
+
+        cell = *--top;
+        if ((uintptr_t)cell & MARK_ITEMS) {
+            /* the next item of an array */
+            cell = (cell_t *)((uintptr_t)cell & ~(uintptr_t)MARK_ITEMS);
+            if (cell + 1 < top[-1])
+                *top++ = (cell_t *)((uintptr_t)(cell + 1) | MARK_ITEMS);
+            else
+                --top;
         }
+    }
+}
+
+static void mark_from(secd_t *secd, cell_t *cell) {
+    if (is_nil(cell) || is_immediate(cell))
+        return;
+    mark_cells(secd, cell, (cell_t **)secd->fixedptr, (cell_t **)secd->arrayptr);
+}
+
+#if (PARALLELMARK)
+/*
+ *  Parallel marking: secd->markthreads workers, the interpreter thread
+ *  is the first one. The free space is divided between their deques
+ *  of cells to visit (Chase and Lev, 2005): a worker takes cells from
+ *  the bottom of its own deque, a worker with nothing to do steals from
+ *  the top of the others. An entry is a cell or the rest of the items
+ *  of an array, so the items of a long array are stolen too.
+ *  Mark bits are set with atomic operations; the rest of a cell
+ *  is only written by the worker that has marked it.
+ */
+#define MARK_THREADS_MAX    64
+#define MARK_DEQUE_MIN      1024
+
+typedef struct {
+    cell_t *cell;
+    cell_t *end;    /* the end of the array for items, NIL for a cell */
+} markentry_t;
+
+typedef struct markshare markshare_t;
+
+typedef struct {
+    secd_t *secd;
+    markshare_t *share;
+    markentry_t *slots;
+    long mask;          /* the deque size is a power of 2 */
+    long top;           /* thieves take from here */
+    long bottom;        /* only the owner changes it */
+    size_t marked;      /* halves of fixed cells marked */
+    unsigned id;
+    bool started;
+    pthread_t thread;
+} markworker_t;
+
+struct markshare {
+    markworker_t workers[MARK_THREADS_MAX];
+    unsigned nworkers;
+    unsigned idle;      /* workers looking for something to steal */
+};
+
+static bool deque_push(markworker_t *w, cell_t *cell, cell_t *end) {
+    long b = w->bottom;
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    if (b - t > w->mask)
+        return false;
+    markentry_t *e = w->slots + (b & w->mask);
+    __atomic_store_n(&e->cell, cell, __ATOMIC_RELAXED);
+    __atomic_store_n(&e->end, end, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool deque_pop(markworker_t *w, markentry_t *e) {
+    long b = w->bottom - 1;
+    __atomic_store_n(&w->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&w->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    *e = w->slots[b & w->mask];
+    if (t < b)
+        return true;
+
+    /* the last entry, a thief may take it first */
+    bool taken = __atomic_compare_exchange_n(&w->top, &t, t + 1, false,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->bottom, b + 1, __ATOMIC_RELAXED);
+    return taken;
+}
+
+static bool deque_steal(markworker_t *w, markentry_t *e) {
+    long t = __atomic_load_n(&w->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b)
+        return false;
+    markentry_t *slot = w->slots + (t & w->mask);
+    e->cell = __atomic_load_n(&slot->cell, __ATOMIC_RELAXED);
+    e->end = __atomic_load_n(&slot->end, __ATOMIC_RELAXED);
+    return __atomic_compare_exchange_n(&w->top, &t, t + 1, false,
+                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static inline bool deque_empty(markworker_t *w) {
+    return __atomic_load_n(&w->top, __ATOMIC_ACQUIRE)
+        >= __atomic_load_n(&w->bottom, __ATOMIC_ACQUIRE);
+}
+
+static inline bool mark_once_shared(markworker_t *w, cell_t *cell) {
+    secd_t *secd = w->secd;
+    if ((cell < secd->begin) || (secd->end <= cell))
+        return false;
+    size_t i = mark_index(secd, cell);
+    uint8_t *byte = secd->markbits + i / 8;
+    uint8_t bit = 1 << (i % 8);
+    if (__atomic_load_n(byte, __ATOMIC_RELAXED) & bit)
+        return false;
+    if (__atomic_fetch_or(byte, bit, __ATOMIC_RELAXED) & bit)
+        return false;
+
+    bool half = cell->half;
+    if (!half)
+        __atomic_fetch_or(byte, bit << 1, __ATOMIC_RELAXED);
+    if (cell < secd->fixedptr)
+        w->marked += (half ? 1 : 2);
+    return true;
+}
+
+static void mark_visit(markworker_t *w, cell_t *cell);
+
+static void mark_share(markworker_t *w, cell_t *cell, cell_t *end) {
+    if (is_nil(cell) || is_immediate(cell))
+        return;
+    mark_prefetch(cell);
+    if (deque_push(w, cell, end))
+        return;
+
+    /* the deque is full */
+    if (is_nil(end)) {
+        mark_visit(w, cell);
     } else {
+        for (; cell < end; ++cell)
+            mark_visit(w, cell);
+    }
+}
+
+static void mark_visit(markworker_t *w, cell_t *cell) {
+    while (mark_once_shared(w, cell)) {
+        if (cell_type(cell) == CELL_ARRMETA) {
+            cell_t *item = meta_mem(cell);
+            cell_t *end = mcons_prev(cell);
+            if (cell->as.mcons.cells && (item < end))
+                mark_share(w, item, end);
+            return;
+        }
+
         cell_t *ref1, *ref2, *ref3;
-        secd_owned_cell_for(secd, cell, &ref1, &ref2, &ref3);
-        if (not_nil(ref1)) increment_nref_for_owned(secd, ref1);
-        if (not_nil(ref2)) increment_nref_for_owned(secd, ref2);
-        if (not_nil(ref3)) increment_nref_for_owned(secd, ref3);
+        secd_owned_cell_for(w->secd, cell, &ref1, &ref2, &ref3);
+        if (is_nil(ref3) || is_immediate(ref3)) {
+            ref3 = ref2; ref2 = SECD_NIL;
+        }
+        if (is_nil(ref3) || is_immediate(ref3)) {
+            ref3 = ref1; ref1 = SECD_NIL;
+        }
+        if (is_nil(ref3) || is_immediate(ref3))
+            return;
+
+        mark_share(w, ref1, SECD_NIL);
+        mark_share(w, ref2, SECD_NIL);
+        cell = ref3;
     }
 }
 
-void secd_mark_and_sweep_gc(secd_t *secd) {
-    /* set all refcounts to zero */
-    cell_t *cell;
-    cell_t *meta;
+static inline void mark_entry(markworker_t *w, markentry_t *e) {
+    if (not_nil(e->end)) {
+        /* the next item of an array, the rest may be stolen */
+        if (e->cell + 1 < e->end)
+            mark_share(w, e->cell + 1, e->end);
+    }
+    mark_visit(w, e->cell);
+}
 
-    for (cell = secd->begin; cell < secd->fixedptr; ++cell)
-        cell->nref = 0;
+static bool mark_steal(markworker_t *w, markentry_t *e) {
+    markshare_t *share = w->share;
+    unsigned i;
+    for (i = 1; i < share->nworkers; ++i) {
+        markworker_t *victim = share->workers + (w->id + i) % share->nworkers;
+        if (deque_steal(victim, e))
+            return true;
+    }
+    return false;
+}
 
-    meta = mcons_next(secd->arrlist);
-    while (not_nil(meta)) {
-        meta->nref = 0;
-        if (meta->as.mcons.cells) {
-            size_t i;
-            size_t len = arrmeta_size(secd, meta);
-            for (i = 0; i < len; ++i)
-                meta_mem(meta)[i].nref = 0;
+static bool mark_anything_left(markworker_t *w) {
+    markshare_t *share = w->share;
+    unsigned i;
+    for (i = 0; i < share->nworkers; ++i)
+        if (!deque_empty(share->workers + i))
+            return true;
+    return false;
+}
+
+static void *mark_work(void *arg) {
+    markworker_t *w = arg;
+    markshare_t *share = w->share;
+    markentry_t e;
+    while (true) {
+        while (deque_pop(w, &e))
+            mark_entry(w, &e);
+        if (mark_steal(w, &e)) {
+            mark_entry(w, &e);
+            continue;
+        }
+
+        /* marking is done when all the workers are idle:
+         * an idle worker has nothing in its deque */
+        __atomic_add_fetch(&share->idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            if (__atomic_load_n(&share->idle, __ATOMIC_SEQ_CST) == share->nworkers)
+                return NULL;
+            if (mark_anything_left(w))
+                break;
+            sched_yield();
         }
-        meta = mcons_next(meta);
+        __atomic_sub_fetch(&share->idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* false if the heap is too small to share marking */
+static bool mark_parallel(secd_t *secd, cell_t **roots, size_t nroots) {
+    unsigned nworkers = secd->markthreads;
+    if (nworkers > MARK_THREADS_MAX)
+        nworkers = MARK_THREADS_MAX;
+    size_t taken = (secd->fixedptr - secd->begin) + (secd->arrlist - secd->arrayptr);
+    if ((nworkers < 2) || (taken < MARK_PARALLEL))
+        return false;
+
+    /* deques take the free space */
+    size_t nslots = (secd->arrayptr - secd->fixedptr) * sizeof(cell_t)
+                    / sizeof(markentry_t) / nworkers;
+    if (nslots < MARK_DEQUE_MIN)
+        return false;
+    long size = MARK_DEQUE_MIN;
+    while ((size_t)(2 * size) <= nslots)
+        size *= 2;
+
+    markshare_t share;
+    share.nworkers = nworkers;
+    share.idle = 0;
+    markentry_t *slots = (markentry_t *)secd->fixedptr;
+    unsigned i;
+    for (i = 0; i < nworkers; ++i) {
+        markworker_t *w = share.workers + i;
+        *w = (markworker_t){ .secd = secd, .share = &share, .id = i,
+                             .slots = slots + i * size, .mask = size - 1 };
     }
 
-    /* set new refcounts */
-    increment_nref_for_owned(secd, secd->stack);
-    increment_nref_for_owned(secd, secd->control);
-    increment_nref_for_owned(secd, secd->env);
-    increment_nref_for_owned(secd, secd->dump);
+    size_t r;
+    for (r = 0; r < nroots; ++r)
+        mark_share(share.workers, roots[r], SECD_NIL);
 
-    increment_nref_for_owned(secd, secd->debug_port);
+    for (i = 1; i < nworkers; ++i) {
+        markworker_t *w = share.workers + i;
+        w->started = !pthread_create(&w->thread, NULL, mark_work, w);
+        if (!w->started) {
+            /* this one has nothing and will never have */
+            __atomic_add_fetch(&share.idle, 1, __ATOMIC_SEQ_CST);
+        }
+    }
+    mark_work(share.workers);
 
-    increment_nref_for_owned(secd, secd->symstore);
+    for (i = 0; i < nworkers; ++i) {
+        markworker_t *w = share.workers + i;
+        if (w->started)
+            pthread_join(w->thread, NULL);
+        secd->stat.unswept -= w->marked;
+    }
+    return true;
+}
+#endif
 
-    /* make new secd->free_list, free unused arrays */
-    secd->free = SECD_NIL;
-    secd->stat.free_cells = 0;
-    for (cell = secd->begin; cell < secd->fixedptr; ++cell) {
-        if (cell->nref == 0) {
-            if (cell_type(cell) != CELL_FREE) {
-                memtracef(";; m&s: cell %ld collected\n",
-                          cell_index(secd, cell));
-            }
+/*
+ *  Sweeping is lazy: secd_mark_and_sweep_gc() only frees unmarked
+ *  arrays, the fixed cells are swept by pop_free() SWEEP_CHUNK at
+ *  a time when it runs out of free cells, from secd->begin up to
+ *  secd->fixedptr. A cell not marked is garbage: its references
+ *  to cells in use are not counted anymore, and it is freed.
+ *  A marked cell stays in use or is freed as usual meanwhile,
+ *  new cells are taken only from the swept part.
+ */
 
+/* a reference from garbage to a cell in use */
+static inline void forget_ref(secd_t *secd, cell_t *ref) {
+    if (is_nil(ref) || is_immediate(ref) || !is_marked(secd, ref))
+        return;
+    /* the last count may be held by native code, it will be
+     * collected next time if it's garbage */
+    if ((ref->nref > 1) && (ref->nref != NREF_MAX))
+        --ref->nref;
+}
+
+static void forget_refs(secd_t *secd, cell_t *cell) {
+    cell_t *ref1, *ref2, *ref3;
+    secd_owned_cell_for(secd, cell, &ref1, &ref2, &ref3);
+    forget_ref(secd, ref1);
+    forget_ref(secd, ref2);
+    forget_ref(secd, ref3);
+}
+
+static void sweep_cell(secd_t *secd, cell_t *cell) {
+#if (COMPACTCONS)
+    if (cell->half) {
+        halfcons_t *pair = (halfcons_t *)cell;
+        bool used0 = is_marked(secd, (cell_t *)pair);
+        bool used1 = is_marked(secd, (cell_t *)(pair + 1));
+        if (!used0)
+            forget_refs(secd, (cell_t *)pair);
+        if (!used1)
+            forget_refs(secd, (cell_t *)(pair + 1));
+        secd->stat.unswept -= !used0 + !used1;
+
+        if (!used0 && !used1) {
+            cell->half = 0;
+            cell->nref = 0;
             push_free(secd, cell);
+        } else if (!used0) {
+            link_free_half(secd, pair);
+        } else if (!used1) {
+            link_free_half(secd, pair + 1);
         }
+        return;
+    }
+#endif
+    if (is_marked(secd, cell))
+        return;
+    if (cell_type(cell) != CELL_FREE) {
+        memtracef(";; m&s: cell %ld collected\n", cell_index(secd, cell));
+        forget_refs(secd, cell);
     }
+    secd->stat.unswept -= 2;
+    cell->nref = 0;
+    push_free(secd, cell);
+}
+
+/* sweeps n fixed cells at most */
+static void sweep_fixed(secd_t *secd, size_t n) {
+    while ((n-- > 0) && (secd->sweepptr < secd->fixedptr)) {
+        cell_t *cell = secd->sweepptr++;
+        sweep_cell(secd, cell);
+    }
+    if (secd->sweepptr >= secd->fixedptr) {
+        /* the rest has gone to the free space */
+        secd->sweepptr = SECD_NIL;
+        secd->stat.unswept = 0;
+    }
+}
+
+static void finish_sweep(secd_t *secd) {
+    while (not_nil(secd->sweepptr))
+        sweep_fixed(secd, SIZE_MAX);
+}
+
+/* cells taken by the fixed and array areas, free cells excluded */
+static size_t heap_used(secd_t *secd) {
+    size_t used = (secd->fixedptr - secd->begin) + (secd->end - secd->arrayptr);
+    used -= secd->stat.free_cells;
+#if (COMPACTCONS)
+    used -= secd->stat.free_halves / 2;
+#endif
+    used -= secd->stat.unswept / 2;
+    return used;
+}
+
+static void schedule_gc(secd_t *secd) {
+    if (secd->gc_threshold == 0) {
+        secd->gc_next = SIZE_MAX;
+        return;
+    }
+    size_t live = heap_used(secd);
+    size_t step = live * (100 - secd->gc_target) / secd->gc_target;
+    if (step < secd->gc_threshold)
+        step = secd->gc_threshold;
+    secd->gc_next = secd->stat.n_alloc + step;
+}
+
+void secd_mark_and_sweep_gc(secd_t *secd) {
+    cell_t *meta;
+
+    /* the garbage left may point to cells reused since */
+    finish_sweep(secd);
+
+    /* clear the marks, all the fixed cells are to be swept */
+    size_t nbits = 2 * (secd->end - secd->begin);
+    memset(secd->markbits, 0, (nbits + 7) / 8);
+    secd->sweepptr = SECD_NIL;
+    secd->stat.unswept = 2 * (secd->fixedptr - secd->begin);
+
+    /* the possible roots of cycles are forgotten */
+    size_t i;
+    for (i = 0; i < secd->ncycroots; ++i)
+        if (is_cycle_root(secd, secd->cycroots[i]))
+            secd->cycroots[i]->color = CYCLE_BLACK;
+    secd->ncycroots = 0;
+
+    /* mark the cells in use */
+    cell_t *roots[] = {
+        secd->stack, secd->control, secd->env, secd->dump,
+#if (ARRAYSTACK)
+        secd->stackarr, secd->dumparr,
+#endif
+        secd->input_port, secd->output_port,
+        secd->error_port, secd->debug_port,
+        secd->truth_value, secd->false_value,
+        secd->symstore, secd->globals
+    };
+    size_t nroots = sizeof(roots) / sizeof(roots[0]);
+
+    bool marked = false;
+#if (PARALLELMARK)
+    marked = mark_parallel(secd, roots, nroots);
+#endif
+    if (!marked)
+        for (i = 0; i < nroots; ++i)
+            mark_from(secd, roots[i]);
+
+    /* forget the free lists, free unused arrays */
+    secd->deadq = SECD_NIL;
+    secd->stat.dead_cells = 0;
+    secd->free = SECD_NIL;
+    secd->stat.free_cells = 0;
+#if (COMPACTCONS)
+    secd->halffree = SECD_NIL;
+    secd->stat.free_halves = 0;
+#endif
 
     cell_t *prevmeta = secd->arrlist;
     meta = mcons_next(secd->arrlist);
     while (not_nil(meta)) {
-        if (is_array_free(secd, meta) || (meta->nref > 0)) {
+        if (is_array_free(secd, meta) || is_marked(secd, meta)) {
             prevmeta = meta;
             meta = mcons_next(meta);
             continue;
         }
 
+        if (meta->as.mcons.cells) {
+            cell_t *item = meta_mem(meta);
+            cell_t *end = mcons_prev(meta);
+            for (; item < end; ++item)
+                forget_refs(secd, item);
+        }
+
         cell_t *pprev = secd->arrlist;
         if (prevmeta != secd->arrlist)
             pprev = mcons_prev(prevmeta);
 
         /* here prevmeta may disappear: */
+        meta->nref = 0;
         free_array(secd, meta_mem(meta));
 
         prevmeta = pprev;
         meta = mcons_next(pprev);
     }
+
+    /* the fixed cells are swept by pop_free() */
+    if (secd->begin < secd->fixedptr)
+        secd->sweepptr = secd->begin;
+
+    ++secd->stat.n_gc;
+    schedule_gc(secd);
+}
+
+/*
+ *  Cycle collection: trial deletion after Bacon and Rajan, "Concurrent
+ *  Cycle Collection in Reference Counted Systems" (2001), done at once.
+ *  drop_cell() remembers a compound cell which is dropped, but still
+ *  in use, as a possible root of a garbage cycle (purple). For every
+ *  root the references inside the cells reachable from it are taken
+ *  out of their counts (gray); a cell still counted is in use from
+ *  outside, it and the cells reachable from it get their counts back
+ *  (black); the rest (white) are referenced only by each other and
+ *  are freed.
+ *  Strings, symbols, numbers and ports don't refer to compound cells,
+ *  the global environment is always in use: they are not looked into,
+ *  a freed white cell just drops them. The items of a cell array are
+ *  a part of its metacons. Cells to visit wait on a stack in the free
+ *  space as in mark_cells().
+ */
+enum cycle_phase { MARK_GRAY, SCAN, SCAN_BLACK, COLLECT_WHITE };
+
+static inline bool in_cycle_graph(secd_t *secd, const cell_t *c) {
+    if ((c == secd->global_env) || (c == secd->globals))
+        return false;
+    switch (c->type) {
+      case CELL_ARRMETA:
+      case CELL_FREE: case CELL_UNDEF:  /* white, freed already */
+        return true;
+      default:
+        return (1u << c->type) & CYCLIC_TYPES;
+    }
+}
+
+static void cycle_walk(secd_t *secd, enum cycle_phase phase,
+                       cell_t *cell, cell_t **base, cell_t **limit);
+
+/* a phase following a reference */
+static cell_t **cycle_ref(secd_t *secd, enum cycle_phase phase,
+                          cell_t *ref, cell_t **top, cell_t **limit)
+{
+    if (is_nil(ref) || is_immediate(ref))
+        return top;
+    if (!in_cycle_graph(secd, ref)) {
+        if (phase == COLLECT_WHITE)
+            drop_cell(secd, ref);
+        return top;
+    }
+
+    switch (phase) {
+      case MARK_GRAY:
+        /* a saturated count is not known, the cell stays in use */
+        if (ref->nref != NREF_MAX)
+            --ref->nref;
+        if (ref->color == CYCLE_GRAY)
+            return top;
+        ref->color = CYCLE_GRAY;
+        ++secd->stat.cycle_grays;
+        break;
+      case SCAN_BLACK:
+        if (ref->nref != NREF_MAX)
+            ++ref->nref;
+        if (ref->color == CYCLE_BLACK)
+            return top;
+        ref->color = CYCLE_BLACK;
+        break;
+      case SCAN:
+        if (ref->color != CYCLE_GRAY)
+            return top;
+        break;
+      case COLLECT_WHITE:
+        if (ref->color != CYCLE_WHITE)
+            return top;
+        break;
+    }
+
+    if (top == limit) {
+        cycle_walk(secd, phase, ref, top, limit);
+        return top;
+    }
+    *top++ = ref;
+    return top;
+}
+
+static cell_t **cycle_refs(secd_t *secd, enum cycle_phase phase,
+                           cell_t *cell, cell_t **top, cell_t **limit)
+{
+    cell_t *ref1, *ref2, *ref3;
+    if (cell_type(cell) == CELL_ARRMETA) {
+        if (!cell->as.mcons.cells)
+            return top;
+
+        cell_t *item = meta_mem(cell);
+        cell_t *end = mcons_prev(cell);
+        for (; item < end; ++item) {
+            secd_owned_cell_for(secd, item, &ref1, &ref2, &ref3);
+            top = cycle_ref(secd, phase, ref1, top, limit);
+            top = cycle_ref(secd, phase, ref2, top, limit);
+            top = cycle_ref(secd, phase, ref3, top, limit);
+        }
+        return top;
+    }
+
+    secd_owned_cell_for(secd, cell, &ref1, &ref2, &ref3);
+    top = cycle_ref(secd, phase, ref1, top, limit);
+    top = cycle_ref(secd, phase, ref2, top, limit);
+    top = cycle_ref(secd, phase, ref3, top, limit);
+    return top;
+}
+
+static void free_white(secd_t *secd, cell_t *cell) {
+    ++secd->stat.cycle_cells;
+    if (cell_type(cell) == CELL_ARRMETA)
+        free_array(secd, meta_mem(cell));
+    else
+        push_free(secd, cell);
+}
+
+/* a phase visiting a cell */
+static cell_t **cycle_visit(secd_t *secd, enum cycle_phase phase,
+                            cell_t *cell, cell_t **top, cell_t **limit)
+{
+    switch (phase) {
+      case MARK_GRAY: case SCAN_BLACK:
+        break;
+      case SCAN:
+        if (cell->color != CYCLE_GRAY)
+            return top;
+        if (cell->nref > 0) {
+            /* in use from outside */
+            cell->color = CYCLE_BLACK;
+            cycle_walk(secd, SCAN_BLACK, cell, top, limit);
+            return top;
+        }
+        cell->color = CYCLE_WHITE;
+        break;
+      case COLLECT_WHITE:
+        if (cell->color != CYCLE_WHITE)
+            return top;
+        cell->color = CYCLE_BLACK;
+        top = cycle_refs(secd, phase, cell, top, limit);
+        free_white(secd, cell);
+        return top;
+    }
+    return cycle_refs(secd, phase, cell, top, limit);
+}
+
+static void cycle_walk(secd_t *secd, enum cycle_phase phase,
+                       cell_t *cell, cell_t **base, cell_t **limit)
+{
+    cell_t **top = base;
+    while (true) {
+        top = cycle_visit(secd, phase, cell, top, limit);
+        if (top == base)
+            return;
+        cell = *--top;
+    }
+}
+
+/* a remembered cell may be freed and its place reused since,
+ * only a purple cell header is still a possible root */
+static bool is_cycle_root(secd_t *secd, cell_t *cell) {
+    if ((cell < secd->begin) || (secd->fixedptr <= cell))
+        return false;
+#if (COMPACTCONS)
+    cell_t *whole = secd->begin + cell_index(secd, cell);
+    if ((cell != whole) && !whole->half)
+        return false;   /* a second half merged into a full cell */
+#endif
+    if (cell->color != CYCLE_PURPLE)
+        return false;
+    if (cell->nref == 0) {
+        /* waits in secd->deadq */
+        cell->color = CYCLE_BLACK;
+        return false;
+    }
+    return true;
+}
+
+void secd_collect_cycles(secd_t *secd) {
+    /* the stack may take the free space, which only grows meanwhile */
+    cell_t **base = (cell_t **)secd->fixedptr;
+    cell_t **limit = (cell_t **)secd->arrayptr;
+    size_t grays = secd->stat.cycle_grays;
+    size_t freed = secd->stat.cycle_cells;
+    size_t n = secd->ncycroots;
+    size_t nroots = 0;
+    size_t i;
+
+    /* the buffer looks full: cells dropped now are not remembered */
+    secd->ncycroots = CYCLE_ROOTS;
+
+    for (i = 0; i < n; ++i) {
+        cell_t *root = secd->cycroots[i];
+        if (!is_cycle_root(secd, root))
+            continue;
+        root->color = CYCLE_GRAY;
+        cycle_walk(secd, MARK_GRAY, root, base, limit);
+        secd->cycroots[nroots++] = root;
+    }
+    for (i = 0; i < nroots; ++i)
+        cycle_walk(secd, SCAN, secd->cycroots[i], base, limit);
+    for (i = 0; i < nroots; ++i)
+        cycle_walk(secd, COLLECT_WHITE, secd->cycroots[i], base, limit);
+
+    secd->ncycroots = 0;
+    ++secd->stat.n_cycles;
+
+    /* cells in use looked at in vain are paid for with allocations
+     * before the next collection, so long lists in use are not
+     * walked over and over */
+    size_t wasted = secd->stat.cycle_grays - grays - (secd->stat.cycle_cells - freed);
+    wasted *= CYCLE_LAZY;
+    secd->cycle_next = secd->stat.n_alloc +
+        (wasted > secd->gc_threshold ? wasted : secd->gc_threshold);
+}
+
+/*
+ *  Array heap compaction: used arrays slide to secd->arrlist,
+ *  all the free areas become the free space before secd->arrayptr.
+ *  While references are fixed, meta->as.mcons.prev of a used array
+ *  is its new place. Only cells may refer to array memory, so this is
+ *  safe when no native code holds pointers into arrays (rundepth 1).
+ */
+
+/* calls fun for every cell of the fixed heap and of cell arrays */
+static void walk_cells(secd_t *secd, void (*fun)(secd_t *, cell_t *)) {
+    cell_t *cell;
+    for (cell = secd->begin; cell < secd->fixedptr; ++cell)
+        if (!cell->half)
+            fun(secd, cell);
+
+    /* sizes are taken from neighbours: as.mcons.prev may be in use */
+    cell_t *upper = secd->arrlist;
+    cell_t *meta = mcons_next(upper);
+    for (; not_nil(meta); upper = meta, meta = mcons_next(meta)) {
+        if (is_array_free(secd, meta) || !meta->as.mcons.cells)
+            continue;
+        for (cell = meta_mem(meta); cell < upper; ++cell)
+            fun(secd, cell);
+    }
+}
+
+static void *relocated(secd_t *secd, void *mem) {
+    cell_t *p = mem;
+    if ((p <= secd->arrayptr) || (secd->arrlist <= p))
+        return mem;
+    cell_t *meta = arr_meta(p);
+    if (is_nil(meta) || is_array_free(secd, meta))
+        return mem;
+    return meta->as.mcons.prev + 1;   /* not a metacons there yet */
+}
+
+static void relocate_array(secd_t *secd, cell_t *cell) {
+    switch (cell_type(cell)) {
+      case CELL_ARRAY:
+        cell->as.arr.data = relocated(secd, cell->as.arr.data);
+        break;
+      case CELL_STR: case CELL_BYTES:
+        cell->as.str.data = relocated(secd, cell->as.str.data);
+        break;
+      default: break;
+    }
+}
+
+/* a symbol points into its symstore slice, which is relocated already */
+static void relocate_symbol(secd_t __unused *secd, cell_t *cell) {
+    if (cell_type(cell) == CELL_SYM) {
+        cell_t *slice = cell->as.sym.bvect;
+        cell->as.sym.data = slice->as.str.data + slice->as.str.offset;
+    }
+}
+
+void secd_compact_arrays(secd_t *secd) {
+    /* garbage cells may point to the old places */
+    finish_sweep(secd);
+
+    /* plan the new places */
+    cell_t *dest = secd->arrlist;
+    cell_t *upper = secd->arrlist;
+    cell_t *meta = mcons_next(upper);
+    for (; not_nil(meta); upper = meta, meta = mcons_next(meta)) {
+        if (is_array_free(secd, meta))
+            continue;
+        dest -= upper - meta;
+        meta->as.mcons.prev = dest;
+    }
+
+    walk_cells(secd, relocate_array);
+    walk_cells(secd, relocate_symbol);
+
+    /* move the arrays with their metaconses, relink them */
+    cell_t *last = secd->arrlist;
+    upper = secd->arrlist;
+    meta = mcons_next(upper);
+    while (not_nil(meta)) {
+        cell_t *next = mcons_next(meta);
+        if (!is_array_free(secd, meta)) {
+            cell_t *to = meta->as.mcons.prev;
+            memmove(to, meta, sizeof(cell_t) * (upper - meta));
+            to->as.mcons.prev = last;
+            last->as.mcons.next = to;
+            last = to;
+        }
+        upper = meta;
+        meta = next;
+    }
+    last->as.mcons.next = SECD_NIL;
+    secd->arrayptr = last;
+
+    int bin;
+    for (bin = 0; bin < ARRAY_BINS; ++bin)
+        secd->arrbins[bin] = SECD_NIL;
+    secd->stat.arr_free = 0;
+    secd->stat.arr_nfree = 0;
+    ++secd->stat.n_compact;
+}
+
+/* compact when free areas take ARRAY_COMPACT percent of the array heap */
+static bool arrays_fragmented(secd_t *secd) {
+    size_t arrsize = secd->arrlist - secd->arrayptr;
+    return secd->stat.arr_free * 100 >= arrsize * ARRAY_COMPACT;
+}
+
+/* the heap grows until used cells take gc_target percent of it,
+ * then it is collected; after a collection the next check comes
+ * when the live cells could take gc_target percent of the used ones.
+ * If the live cells take more than gc_target percent of secd->heapsize,
+ * the heap size is doubled (up to the reserved end - begin) */
+void secd_gc_policy(secd_t *secd) {
+    if ((secd->rundepth > 1) || (secd->gc_threshold == 0)) {
+        /* native code holds cells the collector can't see */
+        schedule_gc(secd);
+        return;
+    }
+
+    if ((secd->ncycroots == CYCLE_ROOTS) && (secd->stat.n_alloc >= secd->cycle_next))
+        secd_collect_cycles(secd);
+
+    if (heap_used(secd) * 100 < secd->heapsize * secd->gc_target) {
+        /* grow into the free part of the heap */
+        secd->gc_next = secd->stat.n_alloc + secd->gc_threshold;
+        return;
+    }
+    secd_mark_and_sweep_gc(secd);
+    if (arrays_fragmented(secd))
+        secd_compact_arrays(secd);
+
+    size_t maxsize = secd->end - secd->begin;
+    while ((heap_used(secd) * 100 >= secd->heapsize * secd->gc_target)
+            && (secd->heapsize < maxsize))
+        secd_set_heapsize(secd, 2 * secd->heapsize);
+}
+
+/* pop_free() or alloc_array() has taken HEAP_RESERVE: the collection by
+ * secd_gc_policy() may have made room, otherwise the computation
+ * fails with an error before the reserve is exhausted */
+cell_t *secd_check_reserve(secd_t *secd) {
+    secd->outofmem = false;
+    secd_release_dead(secd);
+    size_t heapcells = secd->end - secd->begin;
+    if (heap_used(secd) + 2 * HEAP_RESERVE <= heapcells)
+        return SECD_NIL;
+
+    errorf(";; out of memory: %zd cells used\n", heap_used(secd));
+    return new_error(secd, SECD_NIL, "out of memory");
+}
+
+/* half of the reserve is gone and no cells are free:
+ * there is no memory left for an error handler to run in */
+bool secd_reserve_spent(secd_t *secd) {
+    return is_nil(secd->free) && is_nil(secd->sweepptr)
+        && (secd->arrayptr - secd->fixedptr < HEAP_RESERVE / 2);
+}
+
+void secd_set_heapsize(secd_t *secd, size_t ncells) {
+    size_t maxsize = secd->end - secd->begin;
+    secd->heapsize = (ncells < maxsize ? ncells : maxsize);
+}
+
+/* the default garbage collection policy */
+void secd_init_gc(secd_t *secd) {
+    secd->gc_threshold = GC_THRESHOLD;
+    secd->gc_target = GC_TARGET;
+    secd->gc_next = secd->stat.n_alloc + GC_THRESHOLD;
+    secd->outofmem = false;
+    secd->markthreads = MARK_THREADS;
+#if (PARALLELMARK)
+    long ncores = sysconf(_SC_NPROCESSORS_ONLN);
+    if ((0 < ncores) && (ncores < MARK_THREADS))
+        secd->markthreads = ncores;
+#endif
 }
 
 void secd_init_mem(secd_t *secd, cell_t *heap, size_t size) {
+    /* the mark bits take the last cells */
+    size_t markcells = (2 * size / 8) / sizeof(cell_t) + 1;
+    size -= markcells;
+
     secd->begin = heap;
     secd->end = heap + size;
+    secd->heapsize = size;
+    secd->markbits = (uint8_t *)secd->end;
+    secd->sweepptr = SECD_NIL;
 
     secd->fixedptr = secd->begin;
     secd->arrayptr = secd->end - 1;
@@ -1384,14 +3040,38 @@ void secd_init_mem(secd_t *secd, cell_t *heap, size_t size) {
     secd->stat.used_dump = 0;
     secd->stat.used_control = 0;
     secd->stat.free_cells = 0;
+    secd->stat.free_halves = 0;
     secd->stat.n_alloc = 0;
+    secd->stat.n_gc = 0;
+    secd->stat.n_compact = 0;
+    secd->stat.unswept = 0;
+    secd->stat.arr_free = 0;
+    secd->stat.arr_nfree = 0;
+    secd->stat.arr_allocs = 0;
+    secd->stat.arr_probes = 0;
+    secd->stat.dead_cells = 0;
+    secd->stat.dead_max = 0;
+    secd->stat.n_cycles = 0;
+    secd->stat.cycle_cells = 0;
+    secd->stat.cycle_grays = 0;
+    secd->ncycroots = 0;
+    secd->cycle_next = 0;
+
+    secd_init_gc(secd);
 
     /* init array management */
     secd->arrlist = secd->arrayptr;
     init_meta(secd, secd->arrlist, SECD_NIL, SECD_NIL);
     secd->arrlist->nref = DONT_FREE_THIS;
+    int bin;
+    for (bin = 0; bin < ARRAY_BINS; ++bin)
+        secd->arrbins[bin] = SECD_NIL;
 
     /* init symbol storage */
     init_symstorage(secd);
+
+#if (ARRAYSTACK)
+    init_array_stacks(secd);
+#endif
 }
 
@@ -33,6 +33,7 @@ cell_t *new_clone(secd_t *secd, cell_t *from);
 cell_t *new_error(secd_t *secd, cell_t *info, const char *fmt, ...);
 cell_t *new_continuation(secd_t *secd, cell_t *s, cell_t *e, cell_t *c);
 cell_t *new_current_continuation(secd_t *secd);
+cell_t *new_current_control(secd_t *secd);
 
 cell_t *copy_value(
         secd_t *secd,
@@ -45,7 +46,21 @@ cell_t *free_cell(secd_t *, cell_t *c);
 cell_t *push_stack(secd_t *secd, cell_t *newc);
 cell_t *pop_stack(secd_t *secd);
 
+/* a call starts a new frame of S, RTN gets back to the frame of kont */
+cell_t *new_stack_frame(secd_t *secd);
+void clear_stack_frame(secd_t *secd);
+void restore_stack_frame(secd_t *secd, cell_t *kont);
+
+/* S and D of a first-class continuation */
+cell_t *capture_stack(secd_t *secd);
+void reinstate_stack(secd_t *secd, cell_t *captured);
+cell_t *capture_dump(secd_t *secd);
+void reinstate_dump(secd_t *secd, cell_t *captured);
+
+/* secd->control is a cursor into a code vector, owned by the machine:
+ * a CELL_ARRAY with as.arr.offset used as the program counter */
 cell_t *set_control(secd_t *secd, cell_t **opcons);
+cell_t *restore_control(secd_t *secd, cell_t *kont);
 cell_t *pop_control(secd_t *secd);
 
 cell_t *push_dump(secd_t *secd, cell_t *cell);
@@ -56,8 +71,12 @@ cell_t *pop_dump(secd_t *secd);
  */
 
 inline static cell_t *share_cell(secd_t __unused *secd, cell_t *c) {
+    if (is_immediate(c))
+        return c;
     if (not_nil(c)) {
-        ++c->nref;
+        /* a saturated count is left to the garbage collector */
+        if (c->nref < NREF_MAX)
+            ++c->nref;
         memtracef("share[%ld] %ld\n", cell_index(c), c->nref);
     } else {
         memtracef("share[NIL]\n");
@@ -65,20 +84,46 @@ inline static cell_t *share_cell(secd_t __unused *secd, cell_t *c) {
     return c;
 }
 
+/* compound cells which may be a part of a cycle */
+#define CYCLIC_TYPES  ((1u << CELL_CONS) | (1u << CELL_FRAME) | (1u << CELL_KONT) \
+                     | (1u << CELL_ARRAY) | (1u << CELL_REF) | (1u << CELL_ERROR))
+
+/* a cell dropped, but still in use, may be the last reference
+ * into a garbage cycle: remember it for secd_collect_cycles() */
+inline static void possible_cycle(secd_t *secd, cell_t *c) {
+    if ((c->color == CYCLE_PURPLE) || !((1u << c->type) & CYCLIC_TYPES))
+        return;
+    if (secd->ncycroots >= CYCLE_ROOTS)
+        return;
+    c->color = CYCLE_PURPLE;
+    secd->cycroots[secd->ncycroots++] = c;
+    if ((secd->ncycroots == CYCLE_ROOTS) && (secd->gc_next > secd->cycle_next)) {
+        /* collect at a safe point, see secd_gc_policy() */
+        secd->gc_next = secd->cycle_next;
+    }
+}
+
 inline static int drop_cell(secd_t *secd, cell_t *c) {
     if (is_nil(c)) {
         memtracef("drop [NIL]\n");
         return 1;
     }
+    if (is_immediate(c))
+        return 1;
     if (c->nref <= 0) {
         errorf(";; %lu | error in drop_cell[%ld]: negative nref\n",
                 secd->tick, cell_index(secd, c));
         return -1;
     }
+    if (c->nref == NREF_MAX)
+        return 0;
 
     -- c->nref;
     memtracef("drop [%ld] %ld\n", cell_index(c), c->nref);
-    if (c->nref) return 0;
+    if (c->nref) {
+        possible_cycle(secd, c);
+        return 0;
+    }
     free_cell(secd, c);
     return 0;
 }
@@ -90,6 +135,55 @@ inline static cell_t *assign_cell(secd_t *secd, cell_t **cell, cell_t *what) {
     return *cell;
 }
 
+/*
+ * Changing conses and frames: set_car()/set_cdr()/set_frame_io()
+ * just store the reference; an error means it's been dropped
+ */
+#if (COMPACTCONS)
+cell_t *set_half_ref(secd_t *secd, cell_t *cons, int32_t *ref, cell_t *val);
+#endif
+
+inline static cell_t *set_car(secd_t __unused *secd, cell_t *cons, cell_t *val) {
+#if (COMPACTCONS)
+    if (cons->half)
+        return set_half_ref(secd, cons, &((halfcons_t *)cons)->car, val);
+#endif
+    cons->as.cons.car = val;
+    return SECD_NIL;
+}
+
+inline static cell_t *set_cdr(secd_t __unused *secd, cell_t *cons, cell_t *val) {
+#if (COMPACTCONS)
+    if (cons->half)
+        return set_half_ref(secd, cons, &((halfcons_t *)cons)->cdr, val);
+#endif
+    cons->as.cons.cdr = val;
+    return SECD_NIL;
+}
+
+inline static cell_t *set_frame_io(secd_t __unused *secd, cell_t *frame, cell_t *io) {
+#if (COMPACTCONS)
+    if (frame->half)
+        return set_half_ref(secd, frame, &((halfcons_t *)frame)->aux, io);
+#endif
+    frame->as.frame.io = io;
+    return SECD_NIL;
+}
+
+inline static cell_t *assign_car(secd_t *secd, cell_t *cons, cell_t *what) {
+    cell_t *oldval = get_car(cons);
+    set_car(secd, cons, share_cell(secd, what));
+    drop_cell(secd, oldval);
+    return what;
+}
+
+inline static cell_t *assign_cdr(secd_t *secd, cell_t *cons, cell_t *what) {
+    cell_t *oldval = get_cdr(cons);
+    set_cdr(secd, cons, share_cell(secd, what));
+    drop_cell(secd, oldval);
+    return what;
+}
+
 cell_t *secd_referers_for(secd_t *secd, cell_t *cell);
 void secd_owned_cell_for(secd_t *secd, cell_t *cell, cell_t **ref1, cell_t **ref2, cell_t **ref3);
 
@@ -161,15 +255,111 @@ static inline size_t arr_size(secd_t *secd, const cell_t *arr) {
     return arrmeta_size(secd, arr_val(arr, -1));
 }
 
+/* makes an array item a reference to a shared cell */
+static inline cell_t *
+init_arr_ref(secd_t *secd, cell_t *item, cell_t *to) {
+    item->type = CELL_REF;
+    item->nref = 1;
+    item->as.ref = share_cell(secd, to);
+    return item;
+}
+
 cell_t *fill_array(secd_t *secd, cell_t *arr, cell_t *with);
 cell_t *clear_array(secd_t *secd, cell_t *arr, size_t len);
 
+/*
+ *    S and D access
+ */
+
+#if (ARRAYSTACK)
+static inline bool is_stack_empty(secd_t *secd) {
+    return secd->stackptr == secd->stackbase;
+}
+
+/* the n-th value from the top of S, n < stack depth */
+static inline cell_t *stack_item(secd_t *secd, size_t n) {
+    return arr_ref(secd->stackarr, secd->stackptr - 1 - n);
+}
+
+static inline cell_t *stack_top(secd_t *secd) {
+    if (is_stack_empty(secd))
+        return SECD_NIL;
+    return stack_item(secd, 0)->as.ref;
+}
+
+static inline size_t stack_depth(secd_t *secd) {
+    return secd->stackptr - secd->stackbase;
+}
+
+static inline bool is_dump_empty(secd_t *secd) {
+    return secd->dumpptr == 0;
+}
+
+static inline cell_t *dump_top(secd_t *secd) {
+    if (is_dump_empty(secd))
+        return SECD_NIL;
+    return arr_ref(secd->dumparr, secd->dumpptr - 1)->as.ref;
+}
+
+/* the stack of the caller is kept on S */
+static inline cell_t *kont_stack(secd_t __unused *secd) {
+    return SECD_NIL;
+}
+#else
+static inline bool is_stack_empty(secd_t *secd) {
+    return is_nil(secd->stack);
+}
+
+static inline cell_t *stack_top(secd_t *secd) {
+    if (is_nil(secd->stack))
+        return SECD_NIL;
+    return get_car(secd->stack);
+}
+
+static inline bool is_dump_empty(secd_t *secd) {
+    return is_nil(secd->dump);
+}
+
+static inline cell_t *dump_top(secd_t *secd) {
+    if (is_nil(secd->dump))
+        return SECD_NIL;
+    return get_car(secd->dump);
+}
+
+static inline cell_t *kont_stack(secd_t *secd) {
+    return secd->stack;
+}
+#endif
+
+/*
+ *    Code vector routines
+ */
+
+/* the code vector cell at the program counter */
+static inline cell_t *control_peek(secd_t *secd) {
+    cell_t *cursor = secd->control;
+    return cursor->as.arr.data + cursor->as.arr.offset;
+}
+
+/* relative jump from the current program counter */
+static inline void control_jump(secd_t *secd, long offset) {
+    secd->control->as.arr.offset += offset;
+}
+
 /*
  *    Global machine operations
  */
 
 void secd_mark_and_sweep_gc(secd_t *secd);
-
+void secd_collect_cycles(secd_t *secd);
+void secd_gc_policy(secd_t *secd);
+cell_t *secd_check_reserve(secd_t *secd);
+bool secd_reserve_spent(secd_t *secd);
+void secd_compact_arrays(secd_t *secd);
+void secd_release_dead(secd_t *secd);
+size_t secd_arr_maxfree(secd_t *secd);
+
+void secd_init_gc(secd_t *secd);
 void secd_init_mem(secd_t *secd, cell_t *heap, size_t size);
 
 /*
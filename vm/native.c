@@ -179,7 +179,7 @@ static size_t utf8list_len(secd_t *secd, cell_t *lst) {
             return strsize;
         }
 
-        strsize += utf8len(numval(cur));
+        strsize += utf8len(numval(num));
         cur = list_next(secd, cur);
     }
 
@@ -204,7 +204,7 @@ static cell_t *list_copy(secd_t *secd, cell_t *list, cell_t **out_tail) {
 
     while (not_nil(list = list_next(secd, list))) {
         cell_t *new_cell = new_cons(secd, get_car(list), SECD_NIL);
-        new_tail->as.cons.cdr = share_cell(secd, new_cell);
+        set_cdr(secd, new_tail, share_cell(secd, new_cell));
         new_tail = list_next(secd, new_tail);
     }
     if (out_tail)
@@ -245,13 +245,13 @@ cell_t *secdf_append(secd_t *secd, cell_t *args) {
 
     if (sum_tail) {
         ctrldebugf("secdf_append: destructive append\n");
-        sum_tail->as.cons.cdr = share_cell(secd, ys);
+        set_cdr(secd, sum_tail, share_cell(secd, ys));
         sum = xs;
     } else {
         ctrldebugf("secdf_append: copying append\n");
         cell_t *sum_tail;
         sum = list_copy(secd, xs, &sum_tail);
-        sum_tail->as.cons.cdr = share_cell(secd, ys);
+        set_cdr(secd, sum_tail, share_cell(secd, ys));
     }
 
     return sum;
@@ -339,12 +339,40 @@ cell_t *secdf_ctl(secd_t *secd, cell_t *args) {
     cell_t *arg1 = list_head(args);
     if (is_symbol(arg1)) {
         if (str_eq(symname(arg1), "mem")) {
-            secd_printf(secd, ";;  size = %zd\n", secd->end - secd->begin);
+            secd_printf(secd, ";;  size = %zd (%zd reserved)\n",
+                        secd->heapsize, secd->end - secd->begin);
             secd_printf(secd, ";;  fixedptr = %zd\n", secd->fixedptr - secd->begin);
             secd_printf(secd, ";;  arrayptr = %zd (%zd)\n",
                          secd->arrayptr - secd->begin, secd->arrayptr - secd->end);
             secd_printf(secd, ";;  Fixed cells: %zd free\n", secd->stat.free_cells);
+#if (COMPACTCONS)
+            secd_printf(secd, ";;  Half cells: %zd free\n", secd->stat.free_halves);
+#endif
             secd_printf(secd, ";;  Allocated cells: %zd total\n", secd->stat.n_alloc);
+            secd_printf(secd, ";;  Dropped cells: %zd waiting, %zd at most\n",
+                        secd->stat.dead_cells, secd->stat.dead_max);
+            secd_printf(secd, ";;  Collections: %zd, %zd compactions, next check at %zd\n",
+                        secd->stat.n_gc, secd->stat.n_compact, secd->gc_next);
+            if (not_nil(secd->sweepptr))
+                secd_printf(secd, ";;  Sweeping: %zd cells to go, %zd halves unused\n",
+                            secd->fixedptr - secd->sweepptr, secd->stat.unswept);
+            secd_printf(secd, ";;  Cycle collections: %zd, %zd cells looked at, %zd freed, "
+                              "%zd possible roots\n",
+                        secd->stat.n_cycles, secd->stat.cycle_grays,
+                        secd->stat.cycle_cells, secd->ncycroots);
+
+            /* fragmentation: the part of free array cells
+             * that can't be taken by the largest allocation */
+            size_t arrfree = secd->stat.arr_free;
+            size_t maxfree = secd_arr_maxfree(secd);
+            secd_printf(secd, ";;  Array areas: %zd cells free in %zd, "
+                              "largest %zd (%zd%% fragmented)\n",
+                        arrfree, secd->stat.arr_nfree, maxfree,
+                        (arrfree ? 100 - 100 * maxfree / arrfree : 0));
+            size_t allocs = secd->stat.arr_allocs;
+            secd_printf(secd, ";;  Array allocations: %zd, %zd.%02zd probes each\n",
+                        allocs, (allocs ? secd->stat.arr_probes / allocs : 0),
+                        (allocs ? 100 * secd->stat.arr_probes / allocs % 100 : 0));
             return secd_mem_info(secd);
         } else if (str_eq(symname(arg1), "env")) {
             secd_print_env(secd);
@@ -354,15 +382,21 @@ cell_t *secdf_ctl(secd_t *secd, cell_t *args) {
         } else if (str_eq(symname(arg1), "viewdump")) {
             cell_t *dlist = SECD_NIL;
             cell_t *lstcur = SECD_NIL;
+#if (ARRAYSTACK)
+            size_t i;
+            for (i = secd->dumpptr; i > 0; --i) {
+                cell_t *dmpcur = arr_ref(secd->dumparr, i - 1)->as.ref;
+#else
             cell_t *dmpcur;
             for (dmpcur = secd->dump;
                  not_nil(dmpcur);
                  dmpcur = list_next(secd, dmpcur))
             {
+#endif
                 cell_t *cns = new_cons(secd,
                         new_number(secd, cell_index(secd, dmpcur)), SECD_NIL);
                 if (not_nil(dlist)) {
-                    lstcur->as.cons.cdr = share_cell(secd, cns);
+                    set_cdr(secd, lstcur, share_cell(secd, cns));
                     lstcur = cns;
                 } else {
                     dlist = lstcur = cns;
@@ -394,22 +428,66 @@ cell_t *secdf_ctl(secd_t *secd, cell_t *args) {
             if (is_nil(list_next(secd, args)))
                 goto help;
             cell_t *c = get_car(list_next(secd, args));
-            return new_number(secd, c - secd->begin);
+            return new_number(secd, cell_index(secd, c));
         } else if (str_eq(symname(arg1), "owner")) {
             cell_t *numc = get_car(list_next(secd, args));
             return secd_referers_for(secd, secd->begin + numval(numc));
         } else if (str_eq(symname(arg1), "heap")) {
             print_array_layout(secd);
+        } else if (str_eq(symname(arg1), "opstats")) {
+            secd_print_opstats(secd);
         } else if (str_eq(symname(arg1), "gc")) {
             secd->postop = SECDPOST_GC;
+        } else if (str_eq(symname(arg1), "cycles")) {
+            secd->postop = SECDPOST_CYCLES;
+        } else if (str_eq(symname(arg1), "image")) {
+            /* saved at the next safe point if the machine was started
+             * with secd -o <file>; its copy loaded with secd -i <file>
+             * gets 'restored from here, see secd_load_image() */
+            if (secd->imagepath) {
+                secd->postop = SECDPOST_IMAGE;
+                return new_symbol(secd, "saved");
+            }
+        } else if (str_eq(symname(arg1), "gcpolicy")) {
+            /* (secd 'gcpolicy [threshold [target]]) */
+            cell_t *opts = list_next(secd, args);
+            if (not_nil(opts)) {
+                assert(is_number(get_car(opts)) && (numval(get_car(opts)) >= 0),
+                       "(secd 'gcpolicy): threshold must be a number of cells");
+                secd->gc_threshold = numval(get_car(opts));
+                opts = list_next(secd, opts);
+            }
+            if (not_nil(opts)) {
+                assert(is_number(get_car(opts))
+                       && (0 < numval(get_car(opts))) && (numval(get_car(opts)) < 100),
+                       "(secd 'gcpolicy): target must be a percentage");
+                secd->gc_target = numval(get_car(opts));
+            }
+            secd->gc_next = secd->stat.n_alloc + secd->gc_threshold;
+            if (secd->gc_threshold == 0)
+                secd->gc_next = SIZE_MAX;
+
+            cell_t *ngc = new_cons(secd, new_number(secd, secd->stat.n_gc), SECD_NIL);
+            cell_t *target = new_cons(secd, new_number(secd, secd->gc_target), ngc);
+            return new_cons(secd, new_number(secd, secd->gc_threshold), target);
         } else if (str_eq(symname(arg1), "tick")) {
             secd_printf(secd, ";; tick = %lu\n", secd->tick);
             return new_number(secd, secd->tick);
         } else if (str_eq(symname(arg1), "state")) {
+#if (ARRAYSTACK)
+            secd_printf(secd, ";; stack = %ld [%zd, frame at %zd]\n",
+                    cell_index(secd, secd->stackarr),
+                    secd->stackptr, secd->stackbase);
+            secd_printf(secd, ";; env   = %ld\n", cell_index(secd, secd->env));
+            secd_printf(secd, ";; ctrl  = %ld\n", cell_index(secd, secd->control));
+            secd_printf(secd, ";; dump  = %ld [%zd]\n\n",
+                    cell_index(secd, secd->dumparr), secd->dumpptr);
+#else
             secd_printf(secd, ";; stack = %ld\n", cell_index(secd, secd->stack));
             secd_printf(secd, ";; env   = %ld\n", cell_index(secd, secd->env));
             secd_printf(secd, ";; ctrl  = %ld\n", cell_index(secd, secd->control));
             secd_printf(secd, ";; dump  = %ld\n\n", cell_index(secd, secd->dump));
+#endif
             secd_printf(secd, ";; %s = %ld\n", 
                     SECD_TRUE,  cell_index(secd, secd->truth_value));
             secd_printf(secd, ";; %s = %ld\n\n",
@@ -427,7 +505,8 @@ cell_t *secdf_ctl(secd_t *secd, cell_t *args) {
     return new_symbol(secd, "ok");
 help:
     errorf(";; Options are 'env, 'mem, 'heap,\n");
-    errorf(";;    'tick, 'dump, 'state, 'viewdump, 'gc, \n");
+    errorf(";;    'tick, 'dump, 'state, 'viewdump, 'gc, 'cycles, 'opstats, 'image,\n");
+    errorf(";;    'gcpolicy [<threshold> [<target %%>]],\n");
     errorf(";;    'where <smth>, 'cell <num>, 'owner <num>\n");
     errorf(";; Use them like (secd 'env) or (secd 'cell 12)\n");
     errorf(";; If you're here first time, explore (secd 'env)\n");
@@ -460,7 +539,8 @@ cell_t *secdf_bind(secd_t *secd, cell_t *args) {
         env = secd->global_env;
     }
 
-    secd_insert_in_frame(secd, list_head(env), sym, val);
+    cell_t *frame = secd_insert_in_frame(secd, list_head(env), sym, val);
+    assert_cell(frame, "secdf_bind: can't bind in this frame");
     return sym;
 }
 
@@ -472,7 +552,7 @@ cell_t *secdf_readlex(secd_t *secd, cell_t *args) {
     if (not_nil(args)) {
         cell_t *scc = get_car(args);
         assert(cell_type(scc) == CELL_CHAR, "(read-lexeme: a char expected");
-        startchar = scc->as.num;
+        startchar = numval(scc);
         if (not_nil(get_cdr(args)))
             get_two_nums(secd, args, (size_t*)&line, 
                                      (size_t*)&pos, "(read-lexeme)");
@@ -543,6 +623,7 @@ cell_t *secdv_make(secd_t *secd, cell_t *args) {
 
     size_t len = numval(num);
     cell_t *arr = new_array(secd, len);
+    assert_cell(arr, "secdv_make: failed to allocate");
 
     if (is_nil(list_next(secd, args)))
         return clear_array(secd, arr, len);
@@ -672,7 +753,7 @@ cell_t *secdf_sym2str(secd_t *secd, cell_t *args) {
 
 static cell_t *string_to_list(secd_t *secd, const char *cstr) {
     cell_t *res = SECD_NIL;
-    cell_t *cur;
+    cell_t *cur = SECD_NIL;
 
     while (1) {
         const char *cnxt = cstr;
@@ -691,7 +772,7 @@ static cell_t *string_to_list(secd_t *secd, const char *cstr) {
         cell_t *nchr = new_char(secd, codepoint);
         cell_t *ncons = new_cons(secd, nchr, SECD_NIL);
         if (not_nil(res)) {
-            cur->as.cons.cdr = share_cell(secd, ncons);
+            set_cdr(secd, cur, share_cell(secd, ncons));
             cur = list_next(secd, cur);
         } else
             res = cur = ncons;
@@ -80,8 +80,11 @@ cell_t *secd_newport(secd_t *secd, const char *mode, const char *ty, cell_t *par
 
     cell_t *p = new_port(secd, pty);
     init_port_mode(secd, p, mode);
-    secd_popen(secd, p, mode, params);
     assert_cell(p, "secd_newport: failed to create a port");
+    if (secd_popen(secd, p, mode, params) < 0) {
+        free_cell(secd, p);
+        return new_error(secd, SECD_NIL, "secd_newport: failed to open a port");
+    }
     return p;
 }
 
@@ -140,15 +143,25 @@ cell_t *secd_setport(secd_t *secd, enum secd_portstd std, cell_t *port) {
 cell_t *secd_port_owns(secd_t *secd, cell_t *p, 
     cell_t **r1, cell_t **r2, cell_t **r3
 ) {
-    assert(is_closed(p), "secd_popen: port is already opened");
-
     portowns_func_t powns = secd_portops(secd, p)->powns;
-    if (powns)
+    if (powns && !is_closed(p))
         return powns(secd, p, r1, r2, r3);
     *r1 = *r2 = *r3 = SECD_NIL;
     return p;
 }
 
+void secd_pimage(secd_t *secd, const cell_t *port, cell_t *img) {
+    *img = *port;
+    portimage_func_t pimage = secd->portops[port->as.port.type]->pimage;
+    if (pimage && !is_closed((cell_t *)port))
+        pimage(secd, port, img);
+}
+
+void secd_prestore(secd_t *secd, cell_t *port, ptrdiff_t delta) {
+    portrestore_func_t prestore = secd_portops(secd, port)->prestore;
+    if (prestore && !is_closed(port))
+        prestore(secd, port, delta);
+}
 
 int secd_popen(secd_t *secd, cell_t *p, const char *mode, cell_t *info) {
     portopen_func_t popen = secd_portops(secd, p)->popen;
@@ -278,13 +291,18 @@ int secd_register_porttype(secd_t *secd, portops_t *ops) {
     return avail;
 }
 
-void secd_init_ports(secd_t *secd) {
+/* port types are the same in every machine, so are their indices */
+void secd_init_porttypes(secd_t *secd) {
     int i;
     for (i = 0; i < SECD_PORTTYPES_MAX; ++i)
         secd->portops[i] = NULL;
 
     secd_register_porttype(secd, secd_strportops());
     secd_register_porttype(secd, secd_fileportops());
+}
+
+void secd_init_ports(secd_t *secd) {
+    secd_init_porttypes(secd);
 
     secd->input_port = share_cell(secd, secd_stdin(secd));
     secd->output_port = share_cell(secd, secd_stdout(secd));
@@ -393,11 +411,17 @@ strport_owns(secd_t __unused *secd, cell_t *p, cell_t **ref1, cell_t **r2, cell_
     strport_t *sp = (strport_t *)p->as.port.data;
     asserti(sp->str, "strport_size: no string");
 
-    *ref1 = arr_meta(arr_mem(sp->str));
+    *ref1 = sp->str;
     *r2 = *r3 = SECD_NIL;
     return p;
 }
 
+static void strport_restore(secd_t __unused *secd, cell_t *p, ptrdiff_t delta) {
+    strport_t *sp = (strport_t *)p->as.port.data;
+    if (sp->str)
+        sp->str = (cell_t *)((char *)sp->str + delta);
+}
+
 portops_t strops = {
     .pinfo = strport_info,
     .popen = strport_open,
@@ -408,6 +432,8 @@ portops_t strops = {
     .pclose = strport_close,
     .powns = strport_owns,
     .pstd = NULL,
+    .pimage = NULL,
+    .prestore = strport_restore,
 };
 
 portops_t * secd_strportops() {
@@ -450,15 +476,15 @@ static int fileport_open(secd_t __unused *secd, cell_t * port, const char *mode,
     }
 
     FILE *f = fopen(fname, mode);
-    io_assert(f, "secd_fopen('%s'): %s\n", fname, strerror(errno));
-
     fp->f = f;
+    io_assert(f, "secd_fopen('%s'): %s\n", fname, strerror(errno));
     return 0;
 }
 
 static int fileport_close(secd_t __unused *secd, cell_t *p) {
     fileport_t *fp = (fileport_t *)p->as.port.data;
-    io_assert(fp->f, "fileport_close: no file");
+    if (!fp->f)
+        return 0;   /* it has not been opened */
 
     int ret = fclose(fp->f);
     fp->f = NULL;
@@ -467,7 +493,7 @@ static int fileport_close(secd_t __unused *secd, cell_t *p) {
 
 static int fileport_getc(secd_t __unused *secd, cell_t *p) {
     fileport_t *fp = (fileport_t *)p->as.port.data;
-    io_assert(fp->f, "fileport_close: no file");
+    io_assert(fp->f, "fileport_getc: no file\n");
 
     int c = fgetc(fp->f);
     if (c == EOF)
@@ -518,6 +544,29 @@ static cell_t *fileport_std(secd_t *secd, enum secd_portstd stdno) {
     }
 }
 
+/* a heap image keeps the standard streams by their numbers,
+ * other files are closed there */
+static void fileport_image(secd_t __unused *secd, const cell_t *p, cell_t *img) {
+    const fileport_t *fp = (const fileport_t *)p->as.port.data;
+    fileport_t *ifp = (fileport_t *)img->as.port.data;
+    FILE *stdf[] = { stdin, stdout, stderr };
+    size_t i;
+    for (i = 0; i < sizeof(stdf) / sizeof(stdf[0]); ++i)
+        if (fp->f == stdf[i]) {
+            ifp->f = (FILE *)(i + 1);
+            return;
+        }
+    ifp->f = NULL;
+    img->as.port.input = img->as.port.output = false;
+}
+
+static void fileport_restore(secd_t __unused *secd, cell_t *p, ptrdiff_t __unused delta) {
+    fileport_t *fp = (fileport_t *)p->as.port.data;
+    FILE *stdf[] = { stdin, stdout, stderr };
+    size_t i = (size_t)fp->f - 1;
+    fp->f = (i < sizeof(stdf) / sizeof(stdf[0]) ? stdf[i] : NULL);
+}
+
 portops_t fileops = {
     .pinfo = fileport_info,
     .popen = fileport_open,
@@ -527,6 +576,8 @@ portops_t fileops = {
     .psize = fileport_size,
     .pclose = fileport_close,
     .pstd = fileport_std,
+    .pimage = fileport_image,
+    .prestore = fileport_restore,
 };
 
 portops_t * secd_fileportops() {
@@ -10,7 +10,7 @@
 #include <limits.h>
 
 void sexp_print_opcode(secd_t *secd, cell_t *port, opindex_t op) {
-    if (op < SECD_LAST) {
+    if ((op < SECD_OPCOUNT) && (op != SECD_LAST)) {
         secd_pprintf(secd, port, "#.%s ", opcode_table[op].name);
         return;
     }
@@ -22,6 +22,11 @@ void dbg_print_cell(secd_t *secd, const cell_t *c) {
          secd_printf(secd, "NIL\n");
          return;
     }
+    if (is_immediate(c)) {
+        printf("IMM(%s %d)\n",
+               (cell_type(c) == CELL_CHAR ? "char" : "int"), numval(c));
+        return;
+    }
     char buf[128];
     if (c->nref > DONT_FREE_THIS - 100000) strncpy(buf, "-", 64);
     else snprintf(buf, 128, "%ld", (long)c->nref);
@@ -36,10 +41,10 @@ void dbg_print_cell(secd_t *secd, const cell_t *c) {
         printf("FRAME(syms: [%ld], vals: [%ld])\n",
                cell_index(secd, get_car(c)), cell_index(secd, get_cdr(c)));
         break;
-      case CELL_INT:  printf("%d\n", c->as.num); break;
+      case CELL_INT:  printf("%d\n", numval(c)); break;
       case CELL_CHAR:
-        if (isprint(c->as.num)) printf("#\\%c\n", (char)c->as.num);
-        else printf("#x%x\n", c->as.num);
+        if (isprint(numval(c))) printf("#\\%c\n", (char)numval(c));
+        else printf("#x%x\n", numval(c));
         break;
       case CELL_OP:
         sexp_print_opcode(secd, secd->output_port, c->as.op);
@@ -47,9 +52,9 @@ void dbg_print_cell(secd_t *secd, const cell_t *c) {
         break;
       case CELL_FUNC: printf("*%p()\n", c->as.ptr); break;
       case CELL_KONT: printf("KONT[%ld, %ld, %ld]\n",
-                             cell_index(secd, c->as.kont.stack),
-                             cell_index(secd, c->as.kont.env),
-                             cell_index(secd, c->as.kont.ctrl)); break;
+                             cell_index(secd, saved_stack(c)),
+                             cell_index(secd, saved_env(c)),
+                             cell_index(secd, saved_ctrl(c))); break;
       case CELL_ARRAY: printf("ARR[%ld]\n",
                                cell_index(secd, arr_val(c, 0))); break;
       case CELL_STR: printf("STR[%ld\n",
@@ -157,10 +162,10 @@ int secd_pdump_array(secd_t *secd, cell_t *p, cell_t *mcons) {
 void sexp_pprint(secd_t* secd, cell_t *port, const cell_t *cell) {
     switch (cell_type(cell)) {
       case CELL_UNDEF:  secd_pprintf(secd, port, "#?"); break;
-      case CELL_INT:    secd_pprintf(secd, port, "%d", cell->as.num); break;
+      case CELL_INT:    secd_pprintf(secd, port, "%d", numval(cell)); break;
       case CELL_CHAR:
-        if (isprint(cell->as.num))
-            secd_pprintf(secd, port, "#\\%c", (char)cell->as.num);
+        if (isprint(numval(cell)))
+            secd_pprintf(secd, port, "#\\%c", (char)numval(cell));
         else
             secd_pprintf(secd, port, "#\\x%x", numval(cell));
         break;
@@ -572,7 +577,7 @@ static cell_t *read_bytevector(secd_parser_t *p) {
 
         cell_t *newc = new_cons(secd, new_number(secd, p->numtok), SECD_NIL);
         if (not_nil(tmplist)) {
-            cur->as.cons.cdr = share_cell(secd, newc);
+            set_cdr(secd, cur, share_cell(secd, newc));
             cur = newc;
         } else {
             tmplist = cur = newc;
@@ -725,14 +730,14 @@ cell_t *read_list(secd_t *secd, secd_parser_t *p) {
 
                   if (is_nil(head)) /* Guile-like: (. val) returns val */
                       return val;
-                  tail->as.cons.cdr = share_cell(secd, val);
+                  set_cdr(secd, tail, share_cell(secd, val));
                   return head;
               }
         }
 
         newtail = new_cons(secd, val, SECD_NIL);
         if (not_nil(head)) {
-            tail->as.cons.cdr = share_cell(secd, newtail);
+            set_cdr(secd, tail, share_cell(secd, newtail));
             tail = newtail;
         } else {
             head = tail = newtail;
@@ -0,0 +1,678 @@
+#include "secd/secd.h"
+#include "secd/secd_io.h"
+
+#include "secdops.h"
+#include "memory.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ *      Compiled code
+ *
+ *  A .secdb file is a program after compile_control_path(): opcodes
+ *  are already CELL_OPs, so secdb_load() builds the control path from
+ *  a mapped file without lexing it and looking opcodes up by name.
+ *  The file is:
+ *    - the header, secdb_header_t;
+ *    - the symbol table: names ending with '\0', every symbol once;
+ *    - the constant pool: strings and bytevectors, a tag, the varint
+ *      length and the bytes (and '\0' for a string);
+ *    - the code: the tree of cells in preorder, a tag byte and its
+ *      operands as unsigned LEB128 varints. A list is its length,
+ *      the items and the tail (SECDB_NIL if it's proper), so nested
+ *      function bodies are just lists in their LDF.
+ *  Symbols and constants are taken from the mapping where they are.
+ */
+
+#define SECDB_MAGIC     "SECDB"
+#define SECDB_VERSION   1
+
+enum secdb_tag {
+    SECDB_NIL,
+    SECDB_LIST,     // n, n items, the tail
+    SECDB_OP,       // opcode index
+    SECDB_SYM,      // index in the symbol table
+    SECDB_INT,      // zigzag-encoded
+    SECDB_CHAR,
+    SECDB_STR,      // index in the constant pool
+    SECDB_BYTES,    //   the same
+    SECDB_VECT,     // n, n items
+};
+
+typedef struct secdb_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nops;          // opcode_count() of the machine,
+    hash_t ops;             //   and the hash of their names
+    uint32_t nsyms;
+    uint32_t nconsts;
+    uint32_t syms_at;       // offsets of the parts in the file
+    uint32_t consts_at;
+    uint32_t code_at;
+    uint32_t size;
+} secdb_header_t;
+
+static hash_t opcodes_hash(uint32_t *count) {
+    hash_t hash = 0;
+    uint32_t i;
+    for (i = 0; i < opcode_count(); ++i)
+        hash = hash * 31 + secd_strhash(opcode_table[i].name);
+    *count = i;
+    return hash;
+}
+
+/*
+ *      Writing
+ */
+
+typedef struct secdb_buf {
+    unsigned char *data;
+    size_t len;
+    size_t size;
+} secdb_buf_t;
+
+static void buf_put(secdb_buf_t *buf, const void *mem, size_t len) {
+    if (buf->len == (size_t)-1)
+        return;
+    if (buf->len + len > buf->size) {
+        size_t size = (buf->size ? buf->size : 4096);
+        while (size < buf->len + len)
+            size *= 2;
+        unsigned char *data = realloc(buf->data, size);
+        if (!data) {
+            /* the buffer is left as it is, the file is never written */
+            buf->size = buf->len = (size_t)-1;
+            return;
+        }
+        buf->data = data;
+        buf->size = size;
+    }
+    memcpy(buf->data + buf->len, mem, len);
+    buf->len += len;
+}
+
+static void buf_byte(secdb_buf_t *buf, unsigned char b) {
+    buf_put(buf, &b, 1);
+}
+
+static void buf_varint(secdb_buf_t *buf, uint64_t n) {
+    unsigned char bytes[10];
+    size_t len = 0;
+    do {
+        bytes[len] = n & 0x7f;
+        n >>= 7;
+        if (n) bytes[len] |= 0x80;
+        ++len;
+    } while (n);
+    buf_put(buf, bytes, len);
+}
+
+/* names and constants, each of them once */
+typedef struct secdb_atom {
+    const char *data;
+    size_t len;
+    hash_t hash;
+    int tag;
+    uint32_t index;
+} secdb_atom_t;
+
+typedef struct secdb_atoms {
+    secdb_atom_t *slots;
+    size_t nslots;          // a power of 2
+    uint32_t count;
+    secdb_buf_t buf;        // the table, written in the order of indexes
+} secdb_atoms_t;
+
+static hash_t bytes_hash(const char *data, size_t len) {
+    hash_t hash = 2166136261u;      // FNV-1a
+    size_t i;
+    for (i = 0; i < len; ++i)
+        hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+    return hash;
+}
+
+static secdb_atom_t *atoms_slot(secdb_atoms_t *atoms, const secdb_atom_t *key) {
+    size_t i = key->hash & (atoms->nslots - 1);
+    while (atoms->slots[i].data) {
+        secdb_atom_t *atom = atoms->slots + i;
+        if ((atom->hash == key->hash) && (atom->tag == key->tag)
+            && (atom->len == key->len) && !memcmp(atom->data, key->data, key->len))
+            break;
+        i = (i + 1) & (atoms->nslots - 1);
+    }
+    return atoms->slots + i;
+}
+
+static bool atoms_grow(secdb_atoms_t *atoms) {
+    secdb_atoms_t old = *atoms;
+    atoms->nslots = (old.nslots ? 2 * old.nslots : 256);
+    atoms->slots = calloc(atoms->nslots, sizeof(secdb_atom_t));
+    if (!atoms->slots) {
+        *atoms = old;
+        return false;
+    }
+    size_t i;
+    for (i = 0; i < old.nslots; ++i) {
+        secdb_atom_t *atom = old.slots + i;
+        if (atom->data)
+            *atoms_slot(atoms, atom) = *atom;
+    }
+    free(old.slots);
+    return true;
+}
+
+/* the index of the atom, it's appended to the table with tag if new */
+static long atoms_index(secdb_atoms_t *atoms, int tag, const char *data, size_t len) {
+    if (2 * (atoms->count + 1) > atoms->nslots)
+        if (!atoms_grow(atoms))
+            return -1;
+
+    secdb_atom_t key = { .data = data, .len = len,
+                         .hash = bytes_hash(data, len), .tag = tag };
+    secdb_atom_t *atom = atoms_slot(atoms, &key);
+    if (atom->data)
+        return atom->index;
+
+    if (tag == SECDB_SYM) {
+        buf_put(&atoms->buf, data, len);
+    } else {
+        buf_byte(&atoms->buf, tag);
+        buf_varint(&atoms->buf, len);
+        buf_put(&atoms->buf, data, len);
+    }
+    if (tag != SECDB_BYTES)
+        buf_byte(&atoms->buf, '\0');
+
+    *atom = key;
+    atom->index = atoms->count++;
+    return atom->index;
+}
+
+struct secdb_writer {
+    secdb_atoms_t syms;
+    secdb_atoms_t consts;
+    secdb_buf_t code;
+    uint32_t nitems;        // control paths added by secdb_list_add()
+    bool failed;
+};
+
+static int write_cell(secd_t *secd, secdb_writer_t *w, const cell_t *cell);
+
+static int write_atom(secdb_writer_t *w, secdb_atoms_t *atoms, int tag,
+                      const char *data, size_t len)
+{
+    long index = atoms_index(atoms, tag, data, len);
+    if (index < 0)
+        return -1;
+    buf_byte(&w->code, tag);
+    buf_varint(&w->code, index);
+    return 0;
+}
+
+static int write_list(secd_t *secd, secdb_writer_t *w, const cell_t *list) {
+    size_t len = 0;
+    const cell_t *cur = list;
+    while (is_cons(cur) && not_nil(cur)) {
+        ++len;
+        cur = get_cdr(cur);
+    }
+
+    buf_byte(&w->code, SECDB_LIST);
+    buf_varint(&w->code, len);
+    for (cur = list; len--; cur = get_cdr(cur))
+        if (write_cell(secd, w, get_car(cur)))
+            return -1;
+    return write_cell(secd, w, cur);
+}
+
+static int write_cell(secd_t *secd, secdb_writer_t *w, const cell_t *cell) {
+    if (is_nil(cell)) {
+        buf_byte(&w->code, SECDB_NIL);
+        return 0;
+    }
+
+    switch (cell_type(cell)) {
+      case CELL_CONS:
+        return write_list(secd, w, cell);
+      case CELL_OP:
+        buf_byte(&w->code, SECDB_OP);
+        buf_varint(&w->code, cell->as.op);
+        return 0;
+      case CELL_INT: {
+        int64_t n = numval(cell);
+        buf_byte(&w->code, SECDB_INT);
+        buf_varint(&w->code, ((uint64_t)n << 1) ^ (uint64_t)(n >> 63));
+        return 0;
+      }
+      case CELL_CHAR:
+        buf_byte(&w->code, SECDB_CHAR);
+        buf_varint(&w->code, (uint32_t)numval(cell));
+        return 0;
+      case CELL_SYM:
+        return write_atom(w, &w->syms, SECDB_SYM, symname(cell), strlen(symname(cell)));
+      case CELL_STR: {
+        const char *str = strval(cell) + cell->as.str.offset;
+        return write_atom(w, &w->consts, SECDB_STR, str, strlen(str));
+      }
+      case CELL_BYTES:
+        return write_atom(w, &w->consts, SECDB_BYTES, strval(cell), mem_size(cell));
+      case CELL_ARRAY: {
+        size_t len = arr_size(secd, cell);
+        size_t i;
+        buf_byte(&w->code, SECDB_VECT);
+        buf_varint(&w->code, len - cell->as.arr.offset);
+        for (i = cell->as.arr.offset; i < len; ++i) {
+            const cell_t *item = arr_val(cell, i);
+            if (cell_type(item) == CELL_REF)
+                item = item->as.ref;
+            if (write_cell(secd, w, item))
+                return -1;
+        }
+        return 0;
+      }
+      case CELL_REF:
+        return write_cell(secd, w, cell->as.ref);
+      default:
+        errorf(";; secdb_write: a %s can't be saved\n", secd_type_names[cell_type(cell)]);
+        return -1;
+    }
+}
+
+static bool write_all(int fd, const void *mem, size_t len) {
+    const char *p = mem;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static cell_t *compiled_code(secd_t *secd, cell_t *code) {
+    if (is_control_compiled(code))
+        return code;
+    code = compile_control_path(secd, code);
+    if (is_error(code))
+        errorf(";; secdb_write: the control path can't be compiled\n");
+    return code;
+}
+
+static int write_code(secd_t *secd, secdb_writer_t *w, cell_t *code) {
+    code = compiled_code(secd, code);
+    if (is_error(code))
+        return -1;
+
+    share_cell(secd, code);
+    int ret = write_cell(secd, w, code);
+    drop_cell(secd, code);
+    return ret;
+}
+
+/* the file is written aside and renamed, so it's never seen half-written */
+static int writer_save(secd_t *secd, secdb_writer_t *w, const char *path) {
+    secdb_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SECDB_MAGIC, sizeof(SECDB_MAGIC));
+    hdr.version = SECDB_VERSION;
+    hdr.ops = opcodes_hash(&hdr.nops);
+    hdr.nsyms = w->syms.count;
+    hdr.nconsts = w->consts.count;
+    hdr.syms_at = sizeof(hdr);
+    hdr.consts_at = hdr.syms_at + w->syms.buf.len;
+    hdr.code_at = hdr.consts_at + w->consts.buf.len;
+    hdr.size = hdr.code_at + w->code.len;
+
+    if ((w->syms.buf.len == (size_t)-1) || (w->consts.buf.len == (size_t)-1)
+        || (w->code.len == (size_t)-1))
+    {
+        errorf(";; secdb_write: out of memory\n");
+        return -1;
+    }
+
+    char tmppath[PATH_MAX];
+    snprintf(tmppath, sizeof(tmppath), "%s.%d", path, (int)getpid());
+
+    int fd = open(tmppath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = ((fd >= 0)
+            && write_all(fd, &hdr, sizeof(hdr))
+            && write_all(fd, w->syms.buf.data, w->syms.buf.len)
+            && write_all(fd, w->consts.buf.data, w->consts.buf.len)
+            && write_all(fd, w->code.data, w->code.len));
+    if (fd >= 0)
+        ok = (close(fd) == 0) && ok;
+    ok = ok && (rename(tmppath, path) == 0);
+    if (!ok) {
+        errorf(";; secdb_write: can't write %s\n", path);
+        unlink(tmppath);
+        return -1;
+    }
+    return 0;
+}
+
+static void writer_free(secdb_writer_t *w) {
+    free(w->syms.slots); free(w->syms.buf.data);
+    free(w->consts.slots); free(w->consts.buf.data);
+    free(w->code.data);
+}
+
+int secdb_write(secd_t *secd, cell_t *code, const char *path) {
+    secdb_writer_t w;
+    memset(&w, 0, sizeof(w));
+    int ret = write_code(secd, &w, code);
+    if (ret == 0)
+        ret = writer_save(secd, &w, path);
+    writer_free(&w);
+    return ret;
+}
+
+/* a list of control paths, written as they are added:
+ * the cells are not kept while the program goes on */
+secdb_writer_t *secdb_list_new(void) {
+    return calloc(1, sizeof(secdb_writer_t));
+}
+
+int secdb_list_add(secd_t *secd, secdb_writer_t *w, cell_t *code) {
+    if (w->failed)
+        return -1;
+    if (write_code(secd, w, code)) {
+        w->failed = true;
+        return -1;
+    }
+    ++w->nitems;
+    return 0;
+}
+
+/* saves (code1 code2 ...), w is freed */
+int secdb_list_write(secd_t *secd, secdb_writer_t *w, const char *path) {
+    int ret = -1;
+    if (!w->failed && (w->code.len != (size_t)-1)) {
+        secdb_buf_t items = w->code;
+        memset(&w->code, 0, sizeof(w->code));
+
+        buf_byte(&w->code, SECDB_LIST);
+        buf_varint(&w->code, w->nitems);
+        buf_put(&w->code, items.data, items.len);
+        buf_byte(&w->code, SECDB_NIL);
+        free(items.data);
+
+        ret = writer_save(secd, w, path);
+    }
+    secdb_list_free(w);
+    return ret;
+}
+
+void secdb_list_free(secdb_writer_t *w) {
+    writer_free(w);
+    free(w);
+}
+
+/*
+ *      Loading
+ */
+
+typedef struct secdb_reader {
+    const unsigned char *p;
+    const unsigned char *end;
+    bool bad;
+
+    cell_t **syms;          // shared while loading
+    uint32_t nsyms;
+    const unsigned char **consts;   // where each constant is in the file
+    uint32_t nconsts;
+    uint32_t nops;
+} secdb_reader_t;
+
+static uint64_t load_varint(secdb_reader_t *r) {
+    uint64_t n = 0;
+    int shift;
+    for (shift = 0; (r->p < r->end) && (shift < 64); shift += 7) {
+        unsigned char b = *r->p++;
+        n |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return n;
+    }
+    r->bad = true;
+    return 0;
+}
+
+/* the constant's length, r->p is at its bytes then */
+static size_t load_const(secdb_reader_t *r, int tag) {
+    if ((r->p >= r->end) || (*r->p++ != tag)) {
+        r->bad = true;
+        return 0;
+    }
+    uint64_t len = load_varint(r);
+    if (len + (tag == SECDB_STR) > (uint64_t)(r->end - r->p)) {
+        r->bad = true;
+        return 0;
+    }
+    if ((tag == SECDB_STR) && r->p[len]) {
+        r->bad = true;
+        return 0;
+    }
+    return len;
+}
+
+static cell_t *load_cell(secd_t *secd, secdb_reader_t *r);
+
+static cell_t *load_list(secd_t *secd, secdb_reader_t *r) {
+    uint64_t len = load_varint(r);
+    if (len > (uint64_t)(r->end - r->p)) {
+        r->bad = true;
+        return SECD_NIL;
+    }
+
+    cell_t *head = SECD_NIL;
+    cell_t *tail = SECD_NIL;
+    while (len-- && !r->bad) {
+        cell_t *newtail = new_cons(secd, load_cell(secd, r), SECD_NIL);
+        if (not_nil(head)) {
+            set_cdr(secd, tail, share_cell(secd, newtail));
+            tail = newtail;
+        } else {
+            head = tail = newtail;
+        }
+    }
+    cell_t *rest = load_cell(secd, r);
+    if (is_nil(head))
+        return rest;
+    if (not_nil(rest))
+        set_cdr(secd, tail, share_cell(secd, rest));
+    return head;
+}
+
+static cell_t *load_vector(secd_t *secd, secdb_reader_t *r) {
+    uint64_t len = load_varint(r);
+    if (len > (uint64_t)(r->end - r->p)) {
+        r->bad = true;
+        return SECD_NIL;
+    }
+
+    cell_t *items = SECD_NIL;
+    cell_t *tail = SECD_NIL;
+    while (len-- && !r->bad) {
+        cell_t *newtail = new_cons(secd, load_cell(secd, r), SECD_NIL);
+        if (not_nil(items)) {
+            set_cdr(secd, tail, share_cell(secd, newtail));
+            tail = newtail;
+        } else {
+            items = tail = newtail;
+        }
+    }
+    cell_t *vect = list_to_vector(secd, items);
+    if (not_nil(items))
+        free_cell(secd, items);
+    return vect;
+}
+
+static cell_t *load_cell(secd_t *secd, secdb_reader_t *r) {
+    if (r->p >= r->end) {
+        r->bad = true;
+        return SECD_NIL;
+    }
+
+    int tag = *r->p++;
+    switch (tag) {
+      case SECDB_NIL:
+        return SECD_NIL;
+      case SECDB_LIST:
+        return load_list(secd, r);
+      case SECDB_VECT:
+        return load_vector(secd, r);
+      case SECDB_OP: {
+        uint64_t op = load_varint(r);
+        if (op >= r->nops)
+            break;
+        return new_op(secd, op);
+      }
+      case SECDB_INT: {
+        uint64_t n = load_varint(r);
+        return new_number(secd, (int)((n >> 1) ^ -(n & 1)));
+      }
+      case SECDB_CHAR:
+        return new_char(secd, load_varint(r));
+      case SECDB_SYM: {
+        uint64_t i = load_varint(r);
+        if (i >= r->nsyms)
+            break;
+        return r->syms[i];
+      }
+      case SECDB_STR: case SECDB_BYTES: {
+        uint64_t i = load_varint(r);
+        if (i >= r->nconsts)
+            break;
+
+        secdb_reader_t c = *r;
+        c.p = r->consts[i];
+        size_t len = load_const(&c, tag);
+        if (c.bad)
+            break;
+        if (tag == SECDB_STR)
+            return new_string(secd, (const char *)c.p);
+
+        cell_t *bvect = new_bytevector_of_size(secd, len);
+        if (is_error(bvect))
+            return bvect;
+        memcpy(strmem(bvect), c.p, len);
+        return bvect;
+      }
+    }
+    r->bad = true;
+    return SECD_NIL;
+}
+
+static const char *secdb_fits(const secdb_header_t *hdr, size_t size) {
+    uint32_t nops;
+    if (hdr->version != SECDB_VERSION)
+        return "another version of the format";
+    if ((hdr->ops != opcodes_hash(&nops)) || (hdr->nops != nops))
+        return "compiled for other opcodes";
+    if ((hdr->size != size)
+        || (hdr->syms_at < sizeof(secdb_header_t))
+        || (hdr->syms_at > hdr->consts_at) || (hdr->consts_at > hdr->code_at)
+        || (hdr->code_at > hdr->size))
+        return "broken";
+    return NULL;
+}
+
+/* parses the tables, the symbols are interned */
+static bool load_tables(secd_t *secd, secdb_reader_t *r,
+                        const unsigned char *file, const secdb_header_t *hdr)
+{
+    uint32_t i;
+    const unsigned char *p = file + hdr->syms_at;
+    const unsigned char *end = file + hdr->consts_at;
+    for (i = 0; i < hdr->nsyms; ++i) {
+        const unsigned char *nul = memchr(p, '\0', end - p);
+        if (!nul)
+            return false;
+        r->syms[i] = share_cell(secd, new_symbol(secd, (const char *)p));
+        r->nsyms = i + 1;
+        p = nul + 1;
+    }
+
+    secdb_reader_t c = *r;
+    c.p = end;
+    c.end = file + hdr->code_at;
+    for (i = 0; i < hdr->nconsts; ++i) {
+        if (c.p >= c.end)
+            return false;
+        r->consts[i] = c.p;
+        int tag = *c.p;
+        size_t len = load_const(&c, ((tag == SECDB_BYTES) ? SECDB_BYTES : SECDB_STR));
+        if (c.bad)
+            return false;
+        c.p += len + (tag == SECDB_STR);
+    }
+    r->nconsts = hdr->nconsts;
+    return true;
+}
+
+cell_t *secdb_load(secd_t *secd, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return SECD_NIL;
+
+    struct stat st;
+    secdb_header_t hdr;
+    if ((fstat(fd, &st) < 0) || ((size_t)st.st_size < sizeof(hdr))
+        || (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+        || memcmp(hdr.magic, SECDB_MAGIC, sizeof(SECDB_MAGIC)))
+    {
+        /* not compiled code, it's read as text */
+        close(fd);
+        return SECD_NIL;
+    }
+
+    const char *why = secdb_fits(&hdr, st.st_size);
+    if (why) {
+        close(fd);
+        return new_error(secd, SECD_NIL, "secdb_load: %s: %s", path, why);
+    }
+
+    const unsigned char *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return new_error(secd, SECD_NIL, "secdb_load: %s can't be mapped", path);
+
+    secdb_reader_t r;
+    memset(&r, 0, sizeof(r));
+    r.nops = hdr.nops;
+    r.syms = calloc(hdr.nsyms + 1, sizeof(cell_t *));
+    r.consts = calloc(hdr.nconsts + 1, sizeof(unsigned char *));
+
+    cell_t *code = SECD_NIL;
+    cell_t *broken = SECD_NIL;
+    if (!r.syms || !r.consts) {
+        code = new_error(secd, SECD_NIL, "secdb_load: out of memory");
+    } else if (!load_tables(secd, &r, file, &hdr)) {
+        code = new_error(secd, SECD_NIL, "secdb_load: %s: broken tables", path);
+    } else {
+        r.p = file + hdr.code_at;
+        r.end = file + hdr.size;
+        code = load_cell(secd, &r);
+        if (r.bad || (r.p != r.end) || is_nil(code) || !is_cons(code)) {
+            broken = share_cell(secd, code);
+            code = new_error(secd, SECD_NIL, "secdb_load: %s: broken code", path);
+        }
+    }
+
+    /* the symbols are kept by the code now */
+    uint32_t i;
+    for (i = 0; i < r.nsyms; ++i)
+        drop_cell(secd, r.syms[i]);
+    drop_cell(secd, broken);
+
+    free(r.syms);
+    free(r.consts);
+    munmap((void *)file, st.st_size);
+    return code;
+}
@@ -16,4 +16,9 @@ cell_t * compile_ctrl(secd_t *secd, cell_t **ctrl);
 
 int secdop_by_name(const char *name);
 
+/* called directly by the threaded dispatch loop */
+cell_t *secd_ap(secd_t *secd);
+cell_t *secd_tap(secd_t *secd);
+cell_t *secd_rtn(secd_t *secd);
+
 #endif //__SECD_OPS_H__